@@ -23,10 +23,14 @@
 #include <vx68k/iocs.h>
 #include <vm68k/processor.h>
 
+#include <sys/types.h>
 #include <pthread.h>
 
 #include <queue>
+#include <map>
 #include <memory>
+#include <cstdio>
+#include <ctime>
 
 namespace vx68k
 {
@@ -38,7 +42,105 @@ namespace vx68k
 
   const size_t GRAPHICS_VRAM_SIZE = 2 * 1024 * 1024;
 
-  /* Machine of X68000.  */
+  /* Execution profile.  This object counts IOCS and DOS calls and
+     samples the PC of a running context.  */
+  class execution_profile
+  {
+  public:
+    /* What the profiled context is doing.  */
+    enum state {INSTRUCTIONS, IOCS_CALL, DOS_CALL, NSTATES};
+
+    /* Sets the state for a lifetime.  */
+    class scope
+    {
+    private:
+      execution_profile *_p;
+      state saved_state;
+
+    public:
+      scope(execution_profile *p, state s)
+	: _p(p), saved_state(p->current_state) {_p->current_state = s;}
+      ~scope() {_p->current_state = saved_state;}
+    };
+
+    /* Size of a PC range in the histogram.  */
+    static const uint32_type PC_RANGE_SIZE = 0x100;
+
+  private:
+    /* Call counts indexed by the IOCS call number or the low byte of
+       the DOS-call opcode.  */
+    vector<unsigned long> iocs_call_counts;
+    vector<unsigned long> dos_call_counts;
+
+    /* Samples for each PC range and each state.  */
+    map<uint32_type, unsigned long> pc_range_samples;
+    unsigned long state_samples[NSTATES];
+
+    volatile state current_state;
+
+    /* Context whose PC is sampled.  */
+    const context *sampled_context;
+
+    /* Mutex for the samples.  */
+    mutable pthread_mutex_t mutex;
+
+  public:
+    execution_profile();
+    ~execution_profile();
+
+  public:
+    void count_iocs_call(unsigned int funcno)
+    {++iocs_call_counts[funcno & 0xffu];}
+    void count_dos_call(uint16_type op)
+    {++dos_call_counts[op & 0xffu];}
+
+    /* Sets the context to sample.  */
+    void set_sampled_context(const context *c);
+
+    /* Takes a sample.  This function may be called in a separate
+       thread.  */
+    void sample();
+
+    /* Writes a report of the most frequent calls and PC ranges.  */
+    void report(FILE *out) const;
+  };
+
+  /* Instruction handlers that a machine keeps in one of two forms.
+     The hooked form takes a machine step before each call and counts
+     the call to the profile, and is needed only while events are
+     recorded or replayed, checkpoints are taken or a profile is
+     collected.  */
+  class hooked_instructions
+  {
+  public:
+    virtual ~hooked_instructions() {}
+
+    /* Sets the handlers on EU, in the hooked form if HOOKED.  */
+    virtual void set_instructions(processor &eu, bool hooked) = 0;
+  };
+
+  /* Statistics of background checkpoints.  Times are in
+     microseconds.  */
+  struct checkpoint_stats
+  {
+    /* Checkpoints started, skipped because the previous one was still
+       being written, and failed to be written.  */
+    unsigned long started, skipped, failed;
+
+    /* Pages of main memory in the last checkpoint.  */
+    unsigned long last_pages;
+
+    /* Time the guest was paused for the last and the longest
+       checkpoint.  */
+    unsigned long last_pause, max_pause;
+
+    /* Current interval between checkpoints in milliseconds.  */
+    uint32_type interval;
+  };
+
+  /* Machine of X68000.  A process may fork to clone a machine while
+     no other thread is using it; the clone shares the main memory
+     copy-on-write but shares the mapped SRAM with the original.  */
   class machine
   {
   public:
@@ -59,6 +161,9 @@ namespace vx68k
 
     system_rom rom;
 
+    /* Scheduler of device events.  This must precede the devices.  */
+    event_scheduler scheduler;
+
     main_memory mem;
     graphics_video_memory gv;
     text_video_memory tvram;
@@ -79,13 +184,45 @@ namespace vx68k
 
     class processor eu;
 
+  public:
+    /* Kinds of accesses a watchpoint catches.  Execution is a read
+       with a program function code.  */
+    enum watch_kind {WATCH_READ = 1, WATCH_WRITE = 2, WATCH_EXECUTE = 4};
+
+    /* Record of a watchpoint hit in a trace.  Numbers are in host
+       byte order.  */
+    struct watch_record
+    {
+      uint32_type pc;
+      uint32_type address;
+      uint32_type value;
+      unsigned char size;
+      unsigned char function_code;
+      unsigned char kind;
+      unsigned char reserved;
+    };
+
+  private:
+    struct watchpoint
+    {
+      uint32_type first, last;
+      int kinds;
+    };
+
+    /* Watchpoints.  These must precede master_as, which applies them
+       when it is configured.  */
+    vector<watchpoint> watchpoints;
+
+    /* Trace of watchpoint hits, or null.  */
+    FILE *watch_trace;
+
+    /* Context whose PC is recorded for each hit, or null.  */
+    const context *watched_context;
+
     auto_ptr<memory_map> master_as;
     auto_ptr<context> _master_context;
 
   private:
-    /* Last time when timers were checked.  */
-    uint32_type last_check_time;
-
     /* Cursor position.  */
     unsigned int curx, cury;
 
@@ -107,8 +244,92 @@ namespace vx68k
     /* Floppy disks.  */
     iocs::disk *fd[NFDS];
 
+    /* Profile to collect, or null.  */
+    execution_profile *_profile;
+
+    /* Instructions kept in the form hooked_instructions needs.  */
+    vector<hooked_instructions *> hooked_sets;
+
+    /* True if the instructions are in the hooked form.  */
+    bool _hooked;
+
+    /* Speed of the guest clock relative to the host, or zero if the
+       guest clock runs as fast as possible.  */
+    unsigned int _speed;
+
+    /* Host and guest times when the speed was last set.  */
+    uint32_type host_base_time, guest_base_time;
+
+    /* Last host time passed to check_timers.  */
+    uint32_type last_host_time;
+
+    /* Calendar time when the guest clock was connected.  */
+    time_t start_calendar_time;
+
+    /* Guest time when the guest clock was connected.  */
+    uint32_type start_guest_time;
+
+    /* Mutex for the guest clock.  */
+    pthread_mutex_t clock_mutex;
+
+    /* File descriptor for checkpoints, or -1.  */
+    int checkpoint_fildes;
+
+    /* Host time of the last checkpoint.  */
+    uint32_type last_checkpoint_time;
+
+    /* Process writing the last checkpoint, or zero.  */
+    pid_t checkpoint_writer;
+
+    /* Marks of the pages the last checkpoint writes.  */
+    vector<bool> checkpoint_pages;
+
+    checkpoint_stats _checkpoint_stats;
+
+  private:
+    /* Event from the host that affects the guest.  */
+    struct external_event
+    {
+      enum kind_type {KEY, KEY_MODIFIERS, MOUSE_STATE, MOUSE_POSITION,
+		      CLOCK, NKINDS};
+      kind_type kind;
+      long arg1, arg2;
+    };
+
+    /* How external events are delivered.  In the recording and
+       replaying modes, they are delivered only at guest steps.  */
+    enum event_mode {LIVE_EVENTS, RECORDING_EVENTS, REPLAYING_EVENTS};
+
+    volatile event_mode _event_mode;
+
+    /* Number of steps the guest has taken.  */
+    unsigned long _step_count;
+
+    /* File events are recorded to or replayed from.  */
+    FILE *event_file;
+
+    /* Events from the host waiting for the next step while
+       recording.  */
+    queue<external_event> pending_events;
+
+    /* Ready condition for pending_events.  */
+    pthread_cond_t pending_events_not_empty;
+
+    /* Mutex for pending_events.  */
+    pthread_mutex_t pending_events_mutex;
+
+    /* Next event to replay and its step, if has_next_event.  */
+    bool has_next_event;
+    unsigned long next_event_step;
+    external_event next_event;
+
   public:
-    explicit machine(size_t);
+    /* Constructs a machine with MEMORY_SIZE bytes of main memory.
+       The SRAM contents are kept in the file SRAM_FILE_NAME, and the
+       main memory contents in MEMORY_FILE_NAME unless it is null.  */
+    explicit machine(size_t memory_size,
+		     const char *sram_file_name = "sram",
+		     const char *memory_file_name = NULL);
     ~machine();
 
   public:
@@ -119,16 +340,49 @@ namespace vx68k
 
     context *master_context() const {return _master_context.get();}
 
+    execution_profile *profile() const {return _profile;}
+
+    /* Starts or stops (if null) profiling IOCS calls and sampling
+       the PC.  */
+    void set_profile(execution_profile *p);
+
+    /* Adds or removes a set of instructions whose form this machine
+       keeps.  Adding sets them on the processor at once.  */
+    void add_hooked_instructions(hooked_instructions *s);
+    void remove_hooked_instructions(hooked_instructions *s);
+
   public:
     void connect(console *con);
 
     /* Configures address space AS.  */
     void configure(memory_map &as);
 
-    /* Checks timers.  This function may be called in a separate
+    /* Advances the guest clock to host time T and dispatches device
+       events due by then.  This function may be called in a separate
        thread.  */
     void check_timers(uint32_type t);
 
+  public:
+    unsigned int speed() const {return _speed;}
+
+    /* Sets the speed of the guest clock to N times the host, or to
+       as fast as possible if N is zero.  */
+    void set_speed(unsigned int n);
+
+    /* Returns the guest time in milliseconds since the machine was
+       connected to a console.  */
+    uint32_type guest_time() const
+    {return scheduler.current_time() - start_guest_time;}
+
+    /* Returns the calendar time as seen by the guest.  */
+    time_t calendar_time() const;
+
+    /* Tells that the guest is waiting for time to pass.  If the
+       guest clock runs as fast as possible, this advances it to the
+       next device event, through a clock event while recording or
+       replaying.  */
+    void idle();
+
   public:
     unsigned int opm_status() const {return opm.status();}
     void set_opm_reg(unsigned int r, unsigned int v) {opm.set_reg(r, v);}
@@ -140,8 +394,8 @@ namespace vx68k
     void set_vdisp_counter_data(unsigned int n)
     {crtc.set_vdisp_counter_data(n);}
 
-    void set_mouse_state(unsigned int i, bool s) {scc.set_mouse_state(i, s);}
-    void set_mouse_position(int x, int y) {scc.set_mouse_position(x, y);}
+    void set_mouse_state(unsigned int i, bool s);
+    void set_mouse_position(int x, int y);
 
   public:
     /* Returns true once when the screen changed.  */
@@ -161,6 +415,121 @@ namespace vx68k
     /* Unloads the disk on a FD unit.  */
     void unload_fd(unsigned int u);
 
+  public:
+    /* Writes a snapshot of this machine to file descriptor FILDES.
+       The snapshot holds the main memory, the text VRAM, the
+       palettes, device registers and the master context.  */
+    void save_snapshot(int fildes) const;
+
+    /* Restores a snapshot written by save_snapshot from file
+       descriptor FILDES.  The memory size must match.  */
+    void restore_snapshot(int fildes);
+
+    /* Starts taking a checkpoint every INTERVAL milliseconds of host
+       time to file descriptor FILDES, which must be seekable.  The
+       file is always a snapshot that restore_snapshot can read.  */
+    void start_checkpoints(int fildes, uint32_type interval);
+
+    /* Stops taking checkpoints and waits for the last one to be
+       written.  */
+    void stop_checkpoints();
+
+    /* Takes a checkpoint with context C if one is due.  This must be
+       called in the thread running C where its state is consistent,
+       as between instructions.  */
+    void checkpoint_if_due(const context &c)
+    {if (checkpoint_fildes != -1) checkpoint(c);}
+
+    const checkpoint_stats &checkpoint_statistics() const
+    {return _checkpoint_stats;}
+
+  public:
+    /* Starts recording external events to OUT.  Key input, mouse
+       and clock events are then delivered only at guest steps, and
+       each is written with the number of the step.  This must be
+       called after connect.  */
+    void record_events(FILE *out);
+
+    /* Starts replaying external events from IN, as written by
+       record_events.  Events from the host are ignored until the end
+       of the record.  */
+    void replay_events(FILE *in);
+
+    /* Stops recording or replaying external events.  */
+    void stop_events();
+
+    /* Tells that the guest takes a step with context C.  A step is an
+       IOCS or DOS call, or a wait for key input within one, and it is
+       where external events and checkpoints are taken while
+       recording or replaying.  Calls take steps only while their
+       handlers are in the hooked form.  */
+    void step(context &c)
+    {
+      ++_step_count;
+      if (_event_mode != LIVE_EVENTS)
+	deliver_events(false);
+      checkpoint_if_due(c);
+    }
+
+    unsigned long step_count() const {return _step_count;}
+
+    /* Returns a checksum of the main memory contents in the guest
+       byte order.  */
+    uint32_type memory_checksum() const;
+
+  public:
+    /* Adds a watchpoint for the KINDS of accesses from FIRST to LAST.
+       It applies to the master address space and to the address
+       spaces configured later.  Pages without watchpoints are not
+       slowed down.  */
+    void add_watchpoint(uint32_type first, uint32_type last, int kinds);
+
+    /* Writes a watch_record for each watchpoint hit to OUT, or stops
+       if OUT is null.  The PC is that of context C if it is not
+       null.  */
+    void set_watch_trace(FILE *out, const context *c);
+
+    /* Records an access that went through a watch_memory.  */
+    void watch_access(uint32_type address, int size, uint32_type value,
+		      memory::function_code fc, bool write) const;
+
+  private:
+    /* Posts external event E from the host.  */
+    void post_event(const external_event &e);
+
+    /* Applies external event E to the guest.  */
+    void apply_event(const external_event &e);
+
+    /* Delivers external events due at the current step.  If WAIT is
+       true, waits for at least one.  */
+    void deliver_events(bool wait);
+
+    /* Reads the next event to replay.  */
+    void read_event();
+
+    /* Sets the instructions in the hooked form if recording or
+       replaying events, taking checkpoints or profiling, or in the
+       plain form otherwise.  */
+    void update_hooks();
+
+    /* Queues a key input without recording.  */
+    void push_key(uint16_type key);
+
+  private:
+    /* Encodes the header and sections of a snapshot with context C
+       into WORDS.  */
+    void encode_snapshot(const context &c,
+			 vector<uint32_type> &words) const;
+
+    /* Takes a checkpoint with context C if one is due.  The guest is
+       paused only while the state is copied by a fork; a child
+       process writes the modified pages.  */
+    void checkpoint(const context &c);
+
+    /* Waits for the checkpoint writer if BLOCK or if it has exited,
+       and accounts its result.  Returns true if no writer remains.  */
+    bool reap_checkpoint_writer(bool block);
+
   public:
     void b_putc(uint16_type);
     void b_print(const memory_map *as, uint32_type);
@@ -215,20 +584,120 @@ namespace vx68k
       }
   }
 
+  /* Memory that forwards accesses to another memory object and
+     reports them to a machine for its watchpoints.  */
+  class watch_memory: public memory
+  {
+  private:
+    memory *_target;
+    class machine *_m;
+
+  public:
+    watch_memory(memory *target, class machine *m);
+
+  public:
+    memory *target() const
+    {return _target;}
+
+  public:
+    int get_8(uint32_type address, function_code) const
+      throw (memory_exception);
+    uint16_type get_16(uint32_type address, function_code) const
+      throw (memory_exception);
+    uint32_type get_32(uint32_type address, function_code) const
+      throw (memory_exception);
+
+    void put_8(uint32_type address, int, function_code)
+      throw (memory_exception);
+    void put_16(uint32_type address, uint16_type, function_code)
+      throw (memory_exception);
+    void put_32(uint32_type address, uint32_type, function_code)
+      throw (memory_exception);
+  };
+
   /* X68000-specific address space.  This object acts as a program
      interface to the machine.  */
   class x68k_address_space: public memory_map
   {
+  public:
+    /* Size of a page in the table of directly mapped pages.  */
+    static const uint32_type DIRECT_PAGE_SIZE = 0x2000;
+
   private:
     class machine *_m;
 
+    /* Host words of each directly mapped page, or null.  */
+    vector<unsigned short *> direct_pages;
+
+    /* Main memory the direct pages belong to.  */
+    main_memory *direct_memory;
+
+    /* Memory object of each page, or null.  Any access to a page
+       without memory is a bus error.  */
+    vector<memory *> page_memories;
+
+    /* Wrapper installed for a watched page, and its direct mapping
+       before that.  */
+    struct watched_page
+    {
+      watch_memory *wrapper;
+      unsigned short *direct;
+    };
+
+    /* Watched pages by page number.  */
+    map<uint32_type, watched_page> watch_pages;
+
   public:
     x68k_address_space(class machine *m);
+    ~x68k_address_space();
 
   public:
     /* Shortcut for the emulated machine.  */
     class machine *machine() const
     {return _m;}
+
+  public:
+    /* Maps the pages from FIRST to LAST directly to the contents of
+       main memory MM, which must also be filled in that range.  */
+    void map_direct(uint32_type first, uint32_type last, main_memory *mm);
+
+    /* Returns the main memory contents for the N bytes at ADDRESS if
+       ADDRESS is even and all the bytes are in directly mapped pages,
+       or null.  Each word holds two bytes in the layout of main
+       memory; copy_guest_words converts them.  */
+    const unsigned short *direct_span(uint32_type address,
+				      uint32_type n) const;
+
+    /* Likewise for writing with function code FC.  Also returns null
+       if FC may not write all the bytes.  The pages are marked as
+       modified.  */
+    unsigned short *writable_direct_span(uint32_type address, uint32_type n,
+					 memory::function_code fc);
+
+  public:
+    /* Records memory M as the memory of the pages from FIRST to
+       LAST.  */
+    void set_mapped(uint32_type first, uint32_type last, memory *m);
+
+    /* Returns true if the page at ADDRESS has memory.  */
+    bool mapped(uint32_type address) const
+    {return page_memories[(address & 0xffffff) / DIRECT_PAGE_SIZE] != NULL;}
+
+    /* Reads SIZE (1, 2 or 4) bytes at ADDRESS into VALUE with function
+       code FC.  Returns false instead of throwing if the access
+       faults.  Pages without memory fault without calling any memory
+       object, so probing for absent devices is cheap.  */
+    bool probe_read(uint32_type address, int size,
+		    memory::function_code fc, uint32_type &value) const;
+
+    /* Likewise for writing VALUE.  */
+    bool probe_write(uint32_type address, int size, uint32_type value,
+		     memory::function_code fc);
+
+  public:
+    /* Routes the pages with memory from FIRST to LAST through
+       watch_memory objects.  They are no longer directly mapped.  */
+    void watch(uint32_type first, uint32_type last);
   };
 } // vx68k
 
@@ -21,12 +21,16 @@
 #ifndef _VX68K_MEMORY_H
 #define _VX68K_MEMORY_H 1
 
+#include <vx68k/memory-config.h>
 #include <vm68k/processor.h>
 #include <vm68k/memory.h>
 
 #include <pthread.h>
 
+#include <queue>
+#include <map>
 #include <vector>
+#include <string>
 
 namespace vx68k
 {
@@ -38,6 +42,8 @@ namespace vx68k
   using namespace vm68k::types;
   using namespace std;
 
+  class execution_profile;
+
   /* Interface to console.  */
   struct console
   {
@@ -48,6 +54,79 @@ namespace vx68k
     virtual void get_k16_image(unsigned int, unsigned char *, size_t) const = 0;
   };
 
+  /* Interface to devices that have timed events.  */
+  struct timed_device
+  {
+    /* Processes the event due at time T.  The device must schedule
+       its next event if any.  */
+    virtual void process_event(console::time_type t, context &c) = 0;
+  };
+
+  /* Scheduler of timed device events.  Events are dispatched in time
+     order, each with its own due time, so that periodic events are
+     neither lost nor merged when the scheduler runs late.  */
+  class event_scheduler
+  {
+  public:
+    typedef console::time_type time_type;
+
+  private:
+    typedef pair<time_type, timed_device *> event;
+
+    /* Ordering of events that tolerates wrap-around of times.  */
+    struct later
+    {
+      bool operator()(const event &x, const event &y) const
+      {return sint32_type(x.first - y.first) > 0;}
+    };
+
+    /* Pending events, earliest first.  Events that no longer match
+       due_times are stale and skipped.  */
+    priority_queue<event, vector<event>, later> events;
+
+    /* Due time of the next event of each scheduled device.  */
+    map<timed_device *, time_type> due_times;
+
+    /* Time of the event being dispatched, or of the last run.  This
+       is written under the mutex but may be read without it.  */
+    volatile time_type _current_time;
+
+    /* Mutex for this object.  */
+    mutable pthread_mutex_t mutex;
+
+  public:
+    event_scheduler();
+    ~event_scheduler();
+
+  public:
+    /* Returns the current time of this scheduler.  This function
+       takes no lock.  */
+    time_type current_time() const {return _current_time;}
+
+    /* Schedules the next event of device D at time T, replacing any
+       previous one.  */
+    void schedule(timed_device *d, time_type t);
+
+    /* Cancels the next event of device D.  */
+    void cancel(timed_device *d);
+
+    /* Stores the time of the earliest pending event into T and
+       returns true, or returns false if no event is pending.  */
+    bool next_event_time(time_type &t) const;
+
+    /* Dispatches all events due at or before time T, in order, and
+       advances the current time to T.  The current time never goes
+       back.  Devices are called without holding the mutex of this
+       object, so they can schedule themselves while holding their
+       own.  */
+    void run(time_type t, context &c);
+
+  protected:
+    /* Sets the current time to T if it is later.  The mutex must be
+       held.  */
+    void advance(time_type t);
+  };
+
   /* System ROM.  This object handles the IOCS calls.  */
   class system_rom: public memory
   {
@@ -65,6 +144,12 @@ namespace vx68k
     /* Attached execution unit.  */
     processor *attached_eu;
 
+    /* Profile to collect, or null.  */
+    execution_profile *_profile;
+
+    /* True if the IOCS instructions are in the hooked form.  */
+    bool _hooked;
+
   public:
     system_rom();
     ~system_rom();
@@ -90,6 +175,18 @@ namespace vx68k
     /* Initializes memory in an address space.  */
     void initialize(memory_map &);
 
+    execution_profile *profile() const {return _profile;}
+
+    /* Starts or stops (if null) profiling IOCS calls.  Calls are
+       counted only while the IOCS instructions are hooked.  */
+    void set_profile(execution_profile *);
+
+    /* Sets the IOCS instructions on the attached execution unit in
+       the hooked form if HOOKED, or in the plain form otherwise.  The
+       hooked form takes a machine step before each call and counts
+       it to the profile.  */
+    void set_hooked(bool hooked);
+
   public:
     /* Sets an IOCS function.  */
     void set_iocs_call(int, const iocs_call_type &);
@@ -98,6 +195,9 @@ namespace vx68k
     void call_iocs(int, context &);
   };
 
+  /* Size of a page for the marks of modified pages.  */
+  const size_t MEMORY_PAGE_SIZE = 0x1000;
+
   /* Main memory.  This memory is mapped to the address range from 0
      to 0xc00000.  */
   class main_memory: public memory
@@ -109,11 +209,19 @@ namespace vx68k
     /* End of supervisor area.  */
     uint32_type super_area;
 
-    /* Memory contents.  */
+    /* Memory contents, in the layout MAIN_MEMORY_GUEST_ORDER
+       selects.  */
     unsigned short *data;
 
+    /* Marks of modified pages.  */
+    vector<bool> page_marks;
+
   public:
-    explicit main_memory(size_t n);
+    /* Constructs main memory of N bytes.  If FILE_NAME is not null,
+       the contents are mapped from that file and kept there;
+       otherwise they start zero-filled and pages are allocated as
+       they are touched.  */
+    explicit main_memory(size_t n, const char *file_name = NULL);
     ~main_memory();
 
   public:
@@ -134,7 +242,101 @@ namespace vx68k
       throw (memory_exception);
 
   public:
+    /* Returns the memory contents, for snapshots.  */
+    const unsigned short *contents() const {return data;}
+    unsigned short *contents() {return data;}
+
+    size_t super_area_size() const {return super_area;}
     void set_super_area(size_t n);
+
+  public:
+    /* Returns true if the page at ADDRESS was modified since its
+       mark was last cleared.  */
+    bool page_modified(uint32_type address) const;
+
+    /* Moves the marks of modified pages to MARKS, clearing them
+       here.  */
+    void take_page_marks(vector<bool> &marks);
+
+    /* Marks again the pages marked in MARKS.  */
+    void merge_page_marks(const vector<bool> &marks);
+
+    /* Marks all pages as modified.  */
+    void mark_all_pages();
+
+    /* Marks the pages of N bytes at offset I as modified.  */
+    void mark_pages(uint32_type i, uint32_type n);
+
+  public:
+    /* Bulk operations for common loops.  Each of them has the same
+       effect as the equivalent byte loop would, or returns false and
+       has no effect if the range is not entirely in this memory or
+       cannot be written with FC.  */
+
+    /* Copies N bytes from SRC to DEST in ascending order.  */
+    bool copy(uint32_type dest, uint32_type src, uint32_type n,
+	      function_code fc);
+
+    /* Fills N bytes at ADDRESS with VALUE.  */
+    bool fill(uint32_type address, int value, uint32_type n,
+	      function_code fc);
+
+    /* Finds the first byte VALUE at or after ADDRESS and stores its
+       address in FOUND.  */
+    bool find(uint32_type address, int value, uint32_type &found) const;
+  };
+
+  /* Copies N 16-bit words from SRC to DEST, converting between the
+     contents of main memory and bytes in the guest byte order.  The
+     conversion is the same in either direction, and only a copy if
+     MAIN_MEMORY_GUEST_ORDER.  DEST may be SRC but must not overlap it
+     otherwise.  */
+  void copy_guest_words(void *dest, const void *src, size_t n);
+
+  /* Copies N bytes at ADDRESS of AS to DATA with function code FC.
+     Directly mapped main memory is copied in blocks; the rest goes
+     through AS.  */
+  void read_block(const memory_map &as, uint32_type address,
+		  void *data, size_t n, memory::function_code fc);
+
+  /* Copies N bytes from DATA to ADDRESS of AS with function code FC,
+     likewise.  */
+  void write_block(memory_map &as, uint32_type address,
+		   const void *data, size_t n, memory::function_code fc);
+
+  /* NUL-terminated string at an address of an address space.  If
+     MAIN_MEMORY_GUEST_ORDER, a string wholly in directly mapped main
+     memory is used in place.  Otherwise it is copied into this object, which
+     allocates only for strings longer than INLINE_SIZE - 1 bytes.  */
+  class guest_string
+  {
+  public:
+    static const size_t INLINE_SIZE = 256;
+
+  private:
+    const char *_data;
+    size_t _size;
+    char inline_data[INLINE_SIZE];
+    string long_data;
+
+  public:
+    guest_string(const memory_map &as, uint32_type address,
+		 memory::function_code fc);
+
+  private:
+    /* A copy would refer to the inline buffer of the original.  */
+    guest_string(const guest_string &);
+    void operator=(const guest_string &);
+
+  public:
+    /* Returns the bytes of the string, followed by a NUL.  */
+    const char *data() const {return _data;}
+    const char *c_str() const {return _data;}
+
+    /* Returns the number of bytes before the NUL.  */
+    size_t size() const {return _size;}
+
+    string str() const {return string(_data, _size);}
   };
 
   /* Graphics video memory.  This memory is mapped to the address
@@ -272,9 +474,12 @@ namespace vx68k
 
   /* CRTC input/output port memory.  This object also generates VDISP
      interrupts.  */
-  class crtc_memory: public memory
+  class crtc_memory: public memory, public timed_device
   {
   private:
+    /* Scheduler for VDISP events.  */
+    event_scheduler *_scheduler;
+
     /* Time interval between VDISP interrupts in milliseconds.  */
     console::time_type vdisp_interval;
 
@@ -293,7 +498,7 @@ namespace vx68k
     pthread_mutex_t mutex;
 
   public:
-    crtc_memory();
+    explicit crtc_memory(event_scheduler *s);
     ~crtc_memory();
 
   public:
@@ -313,17 +518,21 @@ namespace vx68k
     /* Returns true if VDISP interrupts are enabled.  */
     bool vdisp_interrupt_enabled() const {return vdisp_counter_data != 0;}
 
+    /* Returns the reload value of the VDISP counter.  */
+    unsigned int vdisp_counter_reload() const {return vdisp_counter_data;}
+
     /* Set the reload value of the VDISP counter.  If the value is
        zero, VDISP interrupts are disabled.  */
     void set_vdisp_counter_data(unsigned int);
 
   public:
-    /* Resets internal timestamps.  */
+    /* Resets internal timestamps and schedules the first VDISP
+       event.  */
     void reset(console::time_type t);
 
-    /* Checks timeouts for interrupts.  This function may be called in
-       a separate thread.  */
-    void check_timeouts(console::time_type t, context &c);
+    /* Processes a VDISP event.  This function is called by the
+       scheduler, possibly in a separate thread.  */
+    void process_event(console::time_type t, context &c);
   };
 
   /* Palettes and video controller registers memory.  This memory is
@@ -419,6 +628,13 @@ namespace vx68k
      address range from 0xe88000 to 0xe8a000 on X68000.  */
   class mfp_memory: public memory
   {
+  private:
+    /* Value toggled by each read of an unimplemented register.  */
+    mutable unsigned int toggle_value;
+
+  public:
+    mfp_memory();
+
   public:
     /* Reads data from this object.  */
     int get_8(uint32_type address, function_code) const
@@ -452,17 +668,18 @@ namespace vx68k
   };
 
   /* OPM input/output port memory.  */
-  class opm_memory: public memory
+  class opm_memory: public memory, public timed_device
   {
   private:
+    /* Scheduler for timer events.  */
+    event_scheduler *_scheduler;
+
     int _status;
     vector<unsigned char> _regs;
     bool _interrupt_enabled;
 
     int reg_index;
 
-    console::time_type last_check_time;
-
     /* Intervals for timers A and B.  */
     console::time_type timer_a_interval, timer_b_interval;
 
@@ -472,7 +689,7 @@ namespace vx68k
     pthread_mutex_t mutex;
 
   public:
-    opm_memory();
+    explicit opm_memory(event_scheduler *s);
     ~opm_memory();
 
   public:
@@ -490,6 +707,7 @@ namespace vx68k
 
   public:
     int status() const {return _status;}
+    int reg(int regno) const {return _regs[regno & 0xffu];}
     void set_reg(int, int);
     bool interrupt_enabled() const {return _interrupt_enabled;}
     void set_interrupt_enabled(bool);
@@ -498,9 +716,13 @@ namespace vx68k
     /* Resets times.  */
     void reset(console::time_type t);
 
-    /* Checks timeouts for interrupts.  This function may be called in
-       a separate thread.  */
-    void check_timeouts(console::time_type t, context &c);
+    /* Processes a timer event.  This function is called by the
+       scheduler, possibly in a separate thread.  */
+    void process_event(console::time_type t, context &c);
+
+  protected:
+    /* Schedules the next timer event.  The mutex must be locked.  */
+    void schedule_timers();
   };
 
   /* Input/output memory for the MSM6258V ADPCM chip.  This memory is
@@ -529,6 +751,13 @@ namespace vx68k
      address range from 0xe94000 to 0xe96000 on X68000.  */
   class fdc_memory: public memory
   {
+  private:
+    /* Value toggled by each read of an unimplemented register.  */
+    mutable int toggle_value;
+
+  public:
+    fdc_memory();
+
   public:
     /* Reads data from this object.  */
     int get_8(uint32_type address, function_code) const
@@ -550,7 +779,7 @@ namespace vx68k
   /* Memory for SCC input/output.  This memory also manages mouse
      input.  This memory is mapped to the address range from 0xe98000
      to 0xe9a000 on X68000.  */
-  class scc_memory: public memory
+  class scc_memory: public memory, public timed_device
   {
   public:
     struct point
@@ -559,6 +788,9 @@ namespace vx68k
     };
 
   private:
+    /* Scheduler for mouse sampling.  */
+    event_scheduler *_scheduler;
+
     /* Mouse bounds.  */
     int mouse_left, mouse_top, mouse_right, mouse_bottom;
 
@@ -578,7 +810,7 @@ namespace vx68k
     mutable pthread_mutex_t mutex;
 
   public:
-    scc_memory();
+    explicit scc_memory(event_scheduler *s);
     ~scc_memory();
 
   public:
@@ -623,6 +855,14 @@ namespace vx68k
 
     /* Tracks the mouse motion.  */
     void track_mouse();
+
+  public:
+    /* Schedules the first mouse sampling event.  */
+    void reset(console::time_type t);
+
+    /* Samples the mouse motion.  This function is called by the
+       scheduler, possibly in a separate thread.  */
+    void process_event(console::time_type t, context &c);
   };
 
   /* PPI (a.k.a 8255A) registers memory.  On X68000, a PPI is used for
@@ -660,15 +900,18 @@ namespace vx68k
       throw (memory_exception);
   };
 
-  /* SRAM.  */
+  /* SRAM.  The contents are kept in a host file so that they
+     persist between runs.  */
   class sram: public memory
   {
   private:
     unsigned char *buf;
 
   public:
+    /* Constructs a SRAM backed by the file FILE_NAME, which is
+       created if it does not exist.  */
+    explicit sram(const char *file_name);
     ~sram();
-    sram();
 
   public:
     /* Reads data from this object.  */
@@ -487,16 +487,15 @@ namespace vx68k
 
     namespace
     {
-      unsigned char rgb_table[0x10000 * 3];
-      bool rgb_once;
-
       class pixel_iterator: public output_iterator
       {
       private:
+	const unsigned char *rgb_table;
 	guchar *rgb_ptr;
 
       public:
-	pixel_iterator(guchar *p): rgb_ptr(p) {}
+	pixel_iterator(const unsigned char *t, guchar *p)
+	  : rgb_table(t), rgb_ptr(p) {}
 
       public:
 	bool operator==(const pixel_iterator &another) const
@@ -511,7 +510,7 @@ namespace vx68k
 
 	pixel_iterator &operator=(uint16_type p)
 	{
-	  unsigned char *rgb = rgb_table + p * 3;
+	  const unsigned char *rgb = rgb_table + p * 3;
 	  rgb_ptr[0] = rgb[0];
 	  rgb_ptr[1] = rgb[1];
 	  rgb_ptr[2] = rgb[2];
@@ -546,13 +545,14 @@ namespace vx68k
 	typedef pixel_iterator iterator;
 
       private:
+	const unsigned char *rgb_table;
 	unsigned int width;
 	size_t row_size;
 	guchar *rgb_ptr;
 
       public:
-	row(guchar *p, unsigned int w, size_t n)
-	  : width(w), row_size(n), rgb_ptr(p) {}
+	row(const unsigned char *t, guchar *p, unsigned int w, size_t n)
+	  : rgb_table(t), width(w), row_size(n), rgb_ptr(p) {}
 
       public:
 	bool operator==(const row &another) const
@@ -563,11 +563,11 @@ namespace vx68k
       public:
 	pixel_iterator begin()
 	{
-	  return pixel_iterator(rgb_ptr);
+	  return pixel_iterator(rgb_table, rgb_ptr);
 	}
 	pixel_iterator end()
 	{
-	  return pixel_iterator(rgb_ptr + width * 3);
+	  return pixel_iterator(rgb_table, rgb_ptr + width * 3);
 	}
 
       public:
@@ -583,8 +583,9 @@ namespace vx68k
 	row current;
 
       public:
-	row_iterator(guchar *ptr, unsigned int w, size_t n)
-	  : current(ptr, w, n) {}
+	row_iterator(const unsigned char *t, guchar *ptr, unsigned int w,
+		     size_t n)
+	  : current(t, ptr, w, n) {}
 
       public:
 	bool operator==(const row_iterator &another) const
@@ -613,8 +614,9 @@ namespace vx68k
 	{
 	  if (_m->row_changed(y) || u)
 	    {
-	      _m->scan_row(y, pixel_iterator(rgb_buf + y * row_size),
-			   pixel_iterator(rgb_buf + y * row_size + width * 3));
+	      _m->scan_row(y, pixel_iterator(rgb_table, rgb_buf + y * row_size),
+			   pixel_iterator(rgb_table,
+					  rgb_buf + y * row_size + width * 3));
 
 	      for (vector<GtkWidget *>::const_iterator i = widgets.begin();
 		   i != widgets.end(); ++i)
@@ -681,6 +683,7 @@ namespace vx68k
 
       gdk_threads_leave();
 
+      delete [] rgb_table;
       delete [] rgb_buf;
     }
 
@@ -691,19 +694,18 @@ namespace vx68k
 	row_size(768 * 3),
 	rgb_buf(NULL),
 	counter(1),
+	rgb_table(NULL),
 	timeout(0),
 	primary_font(NULL),
 	kanji16_font(NULL)
     {
-      if (!rgb_once++)
+      rgb_table = new unsigned char [0x10000 * 3];
+      for (uint32_type i = 0; i != 0x10000; ++i)
 	{
-	  for (uint32_type i = 0; i != 0x10000; ++i)
-	    {
-	      unsigned int x = i & 0x1;
-	      rgb_table[i * 3] = (i >> 5 & 0x3e | x) * 0xff / 0x3f;
-	      rgb_table[i * 3 + 1] = (i >> 10 & 0x3e | x) * 0xff / 0x3f;
-	      rgb_table[i * 3 + 2] = (i & 0x3f) * 0xff / 0x3f;
-	    }
+	  unsigned int x = i & 0x1;
+	  rgb_table[i * 3] = (i >> 5 & 0x3e | x) * 0xff / 0x3f;
+	  rgb_table[i * 3 + 1] = (i >> 10 & 0x3e | x) * 0xff / 0x3f;
+	  rgb_table[i * 3 + 2] = (i & 0x3f) * 0xff / 0x3f;
 	}
 
       rgb_buf = new guchar [height * row_size];
@@ -45,6 +45,9 @@ namespace vx68k
       guchar *rgb_buf;
       unsigned int counter;
 
+      /* Table of RGB triplets for each 16-bit color.  */
+      unsigned char *rgb_table;
+
     private:
       guint machine_timeout;
 
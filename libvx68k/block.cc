@@ -0,0 +1,232 @@
+/* Virtual X68000 - X68000 virtual machine
+   Copyright (C) 1998-2002 Hypercore Software Design, Ltd.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+/* Block and string transfers between the guest and the host.  */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#undef const
+#undef inline
+
+#include <vx68k/machine.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+# include <immintrin.h>
+#endif
+
+#include <cstring>
+
+#ifdef HAVE_NANA_H
+# include <nana.h>
+# include <cstdio>
+#else
+# include <cassert>
+# define I assert
+#endif
+
+using namespace vx68k;
+using namespace std;
+
+void
+vx68k::copy_guest_words(void *dest, const void *src, size_t n)
+{
+#ifdef MAIN_MEMORY_GUEST_ORDER
+  if (dest != src)
+    memcpy(dest, src, n * 2);
+#else
+  unsigned char *d = static_cast<unsigned char *>(dest);
+  const unsigned char *s = static_cast<const unsigned char *>(src);
+  size_t i = 0;
+
+  // Each block is loaded before it is stored, so DEST may be SRC.
+# ifdef __AVX2__
+  for (; n - i >= 16; i += 16)
+    {
+      __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>
+				     (s + 2 * i));
+      x = _mm256_or_si256(_mm256_slli_epi16(x, 8), _mm256_srli_epi16(x, 8));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + 2 * i), x);
+    }
+# endif
+# ifdef __SSE2__
+  for (; n - i >= 8; i += 8)
+    {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>
+				  (s + 2 * i));
+      x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(d + 2 * i), x);
+    }
+# endif
+  for (; i != n; ++i)
+    {
+      unsigned char b = s[2 * i];
+      d[2 * i] = s[2 * i + 1];
+      d[2 * i + 1] = b;
+    }
+#endif
+}
+
+void
+vx68k::read_block(const memory_map &as, uint32_type address,
+		  void *data, size_t n, memory::function_code fc)
+{
+  unsigned char *p = static_cast<unsigned char *>(data);
+
+  const x68k_address_space *xas
+    = dynamic_cast<const x68k_address_space *>(&as);
+  if (xas != NULL && n != 0)
+    {
+      if (address % 2 != 0)
+	{
+	  *p++ = as.get_8(address, fc);
+	  address += 1;
+	  n -= 1;
+	}
+
+      const unsigned short *s = xas->direct_span(address, n / 2 * 2);
+      if (s != NULL)
+	{
+	  copy_guest_words(p, s, n / 2);
+	  p += n / 2 * 2;
+	  address += n / 2 * 2;
+	  n %= 2;
+	}
+    }
+
+  if (n != 0)
+    as.read(address, p, n, fc);
+}
+
+void
+vx68k::write_block(memory_map &as, uint32_type address,
+		   const void *data, size_t n, memory::function_code fc)
+{
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+
+  x68k_address_space *xas = dynamic_cast<x68k_address_space *>(&as);
+  if (xas != NULL && n != 0)
+    {
+      if (address % 2 != 0)
+	{
+	  as.put_8(address, *p++, fc);
+	  address += 1;
+	  n -= 1;
+	}
+
+      unsigned short *d = xas->writable_direct_span(address, n / 2 * 2, fc);
+      if (d != NULL)
+	{
+	  copy_guest_words(d, p, n / 2);
+	  p += n / 2 * 2;
+	  address += n / 2 * 2;
+	  n %= 2;
+	}
+    }
+
+  if (n != 0)
+    as.write(address, p, n, fc);
+}
+
+namespace
+{
+  /* Returns the length of the NUL-terminated string at ADDRESS of AS.
+     DIRECT is set to false if any of its bytes is outside directly
+     mapped main memory.  */
+  size_t
+  guest_strlen(const memory_map &as, uint32_type address,
+	       memory::function_code fc, bool &direct)
+  {
+    const uint32_type PAGE_SIZE = x68k_address_space::DIRECT_PAGE_SIZE;
+
+    const x68k_address_space *xas
+      = dynamic_cast<const x68k_address_space *>(&as);
+    direct = xas != NULL;
+
+    size_t n = 0;
+    uint32_type i = address & 0xffffff;
+    for (;;)
+      {
+	uint32_type even = i & ~1u;
+	uint32_type page_end = (i / PAGE_SIZE + 1) * PAGE_SIZE;
+	const unsigned short *w = NULL;
+	if (xas != NULL)
+	  w = xas->direct_span(even, page_end - even);
+	if (w == NULL)
+	  {
+	    direct = false;
+	    if (as.get_8(i, fc) == 0)
+	      return n;
+	    ++n;
+	    i = (i + 1) & 0xffffff;
+	    continue;
+	  }
+
+	// Scans the rest of the page without calling any memory object.
+#ifdef MAIN_MEMORY_GUEST_ORDER
+	const unsigned char *p = reinterpret_cast<const unsigned char *>(w);
+	for (; i != page_end; ++i, ++n)
+	  if (p[i - even] == 0)
+	    return n;
+#else
+	for (; i != page_end; ++i, ++n)
+	  {
+	    unsigned int word = w[(i - even) / 2];
+	    if ((i % 2 != 0 ? word & 0xff : word >> 8) == 0)
+	      return n;
+	  }
+#endif
+	i &= 0xffffff;
+      }
+  }
+} // (unnamed namespace)
+
+guest_string::guest_string(const memory_map &as, uint32_type address,
+			   memory::function_code fc)
+  : _data(inline_data),
+    _size(0)
+{
+  bool direct;
+  _size = guest_strlen(as, address, fc, direct);
+
+#ifdef MAIN_MEMORY_GUEST_ORDER
+  if (direct)
+    {
+      const x68k_address_space *xas
+	= dynamic_cast<const x68k_address_space *>(&as);
+      uint32_type odd = address % 2;
+      const unsigned short *w = xas->direct_span(address - odd,
+						 odd + _size + 1);
+      I(w != NULL);
+      _data = reinterpret_cast<const char *>(w) + odd;
+      return;
+    }
+#endif
+
+  char *p = inline_data;
+  if (_size >= INLINE_SIZE)
+    {
+      long_data.resize(_size + 1);
+      p = &long_data[0];
+    }
+  read_block(as, address, p, _size, fc);
+  p[_size] = '\0';
+  _data = p;
+}
@@ -41,28 +41,37 @@ using namespace std;
 void
 crtc_memory::reset(console::time_type t)
 {
+  mutex_lock lock(&mutex);
+
   vdisp_start_time = t;
+  _scheduler->schedule(this, vdisp_start_time + vdisp_interval);
 }
 
 void
-crtc_memory::check_timeouts(console::time_type t, context &c)
+crtc_memory::process_event(console::time_type t, context &c)
 {
-  mutex_lock lock(&mutex);
+  bool raised = false;
+  {
+    mutex_lock lock(&mutex);
+
+    vdisp_start_time = t;
+    _scheduler->schedule(this, vdisp_start_time + vdisp_interval);
+
+    if (vdisp_interrupt_enabled())
+      {
+	I(vdisp_counter_value > 0);
+	if (--vdisp_counter_value == 0)
+	  {
+	    vdisp_counter_value = vdisp_counter_data;
+	    raised = true;
+	  }
+      }
+  }
 
-  if (t - vdisp_start_time >= vdisp_interval)
-    {
-      vdisp_start_time += vdisp_interval;
-
-      if (vdisp_interrupt_enabled())
-	{
-	  I(vdisp_counter_value > 0);
-	  if (--vdisp_counter_value == 0)
-	    {
-	      vdisp_counter_value = vdisp_counter_data;
-	      c.interrupt(6, 0x4d);
-	    }
-	}
-    }
+  // The interrupt is requested without holding the mutex so that the
+  // CPU thread never waits for this object while it is signalled.
+  if (raised)
+    c.interrupt(6, 0x4d);
 }
 
 void
@@ -140,8 +149,9 @@ crtc_memory::~crtc_memory()
   pthread_mutex_destroy(&mutex);
 }
 
-crtc_memory::crtc_memory()
-  : vdisp_interval(1000 / 55),
+crtc_memory::crtc_memory(event_scheduler *s)
+  : _scheduler(s),
+    vdisp_interval(1000 / 55),
     vdisp_counter_data(0)
 {
   pthread_mutex_init(&mutex, NULL);
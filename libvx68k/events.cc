@@ -0,0 +1,248 @@
+/* Virtual X68000 - X68000 virtual machine
+   Copyright (C) 1998-2002 Hypercore Software Design, Ltd.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+/* Recording and replaying external events.  A record is a text file
+   with a line `calendar TIME' followed by a line `STEP KIND ARG1 ARG2'
+   for each event and a line `STEP end 0 0'.  Clock events hold the
+   guest time since the machine was connected, so that a record can be
+   replayed on a machine connected at a different host time.  */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#undef const
+#undef inline
+
+#include <vx68k/machine.h>
+#include <vm68k/mutex.h>
+
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef HAVE_NANA_H
+# include <nana.h>
+#else
+# include <cassert>
+# define I assert
+#endif
+
+using namespace vx68k;
+using namespace vm68k;
+using namespace std;
+
+namespace
+{
+  /* Names of the event kinds in a record.  */
+  const char *const kind_names[] =
+    {"key", "modifiers", "mouse-state", "mouse-position", "clock"};
+} // (unnamed namespace)
+
+void
+machine::record_events(FILE *out)
+{
+  stop_events();
+
+  fprintf(out, "calendar %ld\n", long(start_calendar_time));
+  event_file = out;
+  _event_mode = RECORDING_EVENTS;
+  update_hooks();
+}
+
+void
+machine::replay_events(FILE *in)
+{
+  stop_events();
+
+  long t;
+  if (fscanf(in, " calendar %ld", &t) != 1)
+    throw runtime_error("replay: not an event record");
+  start_calendar_time = t;
+
+  event_file = in;
+  _event_mode = REPLAYING_EVENTS;
+  update_hooks();
+  read_event();
+}
+
+void
+machine::stop_events()
+{
+  if (_event_mode == RECORDING_EVENTS)
+    {
+      // Events not yet delivered are lost.
+      fprintf(event_file, "%lu end 0 0\n", _step_count);
+      fflush(event_file);
+    }
+
+  _event_mode = LIVE_EVENTS;
+  event_file = NULL;
+  has_next_event = false;
+  update_hooks();
+
+  mutex_lock lock(&pending_events_mutex);
+  while (!pending_events.empty())
+    pending_events.pop();
+}
+
+void
+machine::read_event()
+{
+  I(_event_mode == REPLAYING_EVENTS);
+
+  char name[16];
+  unsigned long step;
+  long arg1, arg2;
+  if (fscanf(event_file, "%lu %15s %ld %ld", &step, name, &arg1, &arg2) != 4
+      || strcmp(name, "end") == 0)
+    {
+      // Back to the host at the end of the record.
+      _event_mode = LIVE_EVENTS;
+      event_file = NULL;
+      has_next_event = false;
+      update_hooks();
+      return;
+    }
+
+  int k = 0;
+  while (strcmp(name, kind_names[k]) != 0)
+    {
+      ++k;
+      if (k == external_event::NKINDS)
+	throw runtime_error("replay: unknown event");
+    }
+
+  next_event_step = step;
+  next_event.kind = external_event::kind_type(k);
+  next_event.arg1 = arg1;
+  next_event.arg2 = arg2;
+  has_next_event = true;
+}
+
+void
+machine::post_event(const external_event &e)
+{
+  switch (_event_mode)
+    {
+    case LIVE_EVENTS:
+      apply_event(e);
+      break;
+
+    case RECORDING_EVENTS:
+      {
+	mutex_lock lock(&pending_events_mutex);
+
+	pending_events.push(e);
+	pthread_cond_signal(&pending_events_not_empty);
+      }
+      break;
+
+    default:
+      // The record supplies the events.
+      break;
+    }
+}
+
+void
+machine::apply_event(const external_event &e)
+{
+  switch (e.kind)
+    {
+    case external_event::KEY:
+      push_key(e.arg1);
+      break;
+
+    case external_event::KEY_MODIFIERS:
+      _key_modifiers = (_key_modifiers & ~e.arg1) ^ e.arg2;
+      break;
+
+    case external_event::MOUSE_STATE:
+      scc.set_mouse_state(e.arg1, e.arg2 != 0);
+      break;
+
+    case external_event::MOUSE_POSITION:
+      scc.set_mouse_position(e.arg1, e.arg2);
+      break;
+
+    case external_event::CLOCK:
+      scheduler.run(start_guest_time + uint32_type(e.arg1),
+		    *master_context());
+      break;
+
+    default:
+      abort();
+    }
+}
+
+void
+machine::deliver_events(bool wait)
+{
+  if (_event_mode == RECORDING_EVENTS)
+    {
+      queue<external_event> q;
+      {
+	mutex_lock lock(&pending_events_mutex);
+
+	while (wait && pending_events.empty())
+	  pthread_cond_wait(&pending_events_not_empty,
+			    &pending_events_mutex);
+	for (; !pending_events.empty(); pending_events.pop())
+	  q.push(pending_events.front());
+      }
+
+      for (; !q.empty(); q.pop())
+	{
+	  const external_event &e = q.front();
+	  fprintf(event_file, "%lu %s %ld %ld\n", _step_count,
+		  kind_names[e.kind], e.arg1, e.arg2);
+	  apply_event(e);
+	}
+    }
+  else if (_event_mode == REPLAYING_EVENTS)
+    {
+      if (wait && has_next_event && next_event_step != _step_count)
+	throw runtime_error("replay: execution diverged from the record");
+
+      while (has_next_event && next_event_step <= _step_count)
+	{
+	  apply_event(next_event);
+	  read_event();
+	}
+    }
+}
+
+uint32_type
+machine::memory_checksum() const
+{
+  // FNV-1a over the bytes in the guest order.
+  uint32_type h = 2166136261U;
+#ifdef MAIN_MEMORY_GUEST_ORDER
+  const unsigned char *p
+    = reinterpret_cast<const unsigned char *>(mem.contents());
+  for (size_t i = 0; i != _memory_size; ++i)
+    h = (h ^ p[i]) * 16777619U;
+#else
+  const unsigned short *p = mem.contents();
+  for (size_t i = 0; i != _memory_size / 2; ++i)
+    {
+      h = (h ^ (p[i] >> 8)) * 16777619U;
+      h = (h ^ (p[i] & 0xff)) * 16777619U;
+    }
+#endif
+
+  return h & 0xffffffffU;
+}
@@ -61,9 +61,8 @@ fdc_memory::get_8(uint32_type address, function_code fc) const
   static bool once;
   if (!once++)
     fprintf(stderr, "class fdc_memory: FIXME: `get_8' not implemented\n");
-  static int value = 0;
-  value ^= 0xd0;
-  return value;
+  toggle_value ^= 0xd0;
+  return toggle_value;
 }
 
 uint16_type
@@ -116,3 +115,8 @@ fdc_memory::put_16(uint32_type address, uint16_type value, function_code fc)
   if (!once++)
     fprintf(stderr, "class fdc_memory: FIXME: `put_16' not implemented\n");
 }
+
+fdc_memory::fdc_memory()
+  : toggle_value(0)
+{
+}
@@ -23,6 +23,7 @@
 #undef inline
 
 #include <vx68k/iocs.h>
+#include <vx68k/memory.h>
 #include <vm68k/processor.h>
 
 #ifdef HAVE_UNISTD_H
@@ -109,7 +110,7 @@ image_file_floppy_disk::read(uint16_type mode, uint32_type pos,
       if (res != 1024)
 	return long_word_size::svalue(0x40202000);
 
-      a.write(buf, data, 1024, memory::SUPER_DATA);
+      vx68k::write_block(a, buf, data, 1024, memory::SUPER_DATA);
 
       buf += 1024;
       nbytes -= 1024;
@@ -113,11 +113,9 @@ machine::b_putc(uint16_type code)
 void
 machine::b_print(const memory_map *as, uint32_type strptr)
 {
-  const string str = as->get_string(strptr, memory::SUPER_DATA);
+  guest_string str(*as, strptr, memory::SUPER_DATA);
 
-  for (string::const_iterator i = str.begin();
-       i != str.end();
-       ++i)
+  for (const char *i = str.data(); i != str.data() + str.size(); ++i)
     {
       b_putc((unsigned char) *i);
     }
@@ -165,6 +163,39 @@ machine::write_disk(const memory_map &as,
     }
 }
 
+namespace
+{
+  /* Starts exception processing for vector VECNO.  A short frame with
+     PC and the old status register is pushed on the supervisor
+     stack.  */
+  void
+  vector_exception(context &c, unsigned int vecno, uint32_type pc)
+  {
+    uint16_type oldsr = c.sr();
+    c.set_supervisor_state(true);
+    c.regs.a[7] -= 6;
+    c.mem->put_32(c.regs.a[7] + 2, pc, memory::SUPER_DATA);
+    c.mem->put_16(c.regs.a[7] + 0, oldsr, memory::SUPER_DATA);
+    c.regs.pc = c.mem->get_32(vecno * 4u, memory::SUPER_DATA);
+  }
+
+  /* Handles a line-F instruction.  This function is an instruction
+     handler.  */
+  void
+  line_f(uint16_type op, context &c, unsigned long data)
+  {
+    vector_exception(c, 11u, c.regs.pc);
+  }
+
+  /* Handles a TRAP instruction other than TRAP #15.  This function is
+     an instruction handler.  */
+  void
+  trap(uint16_type op, context &c, unsigned long data)
+  {
+    vector_exception(c, (op & 0xfu) + 32u, c.regs.pc + 2);
+  }
+} // (unnamed namespace)
+
 void
 machine::boot(context &c)
 {
@@ -179,42 +210,21 @@ machine::boot(context &c)
       throw runtime_error("machine");
     }
 
+  /* The booted system handles line-F instructions and TRAPs through
+     its vectors.  These handlers replace any DOS-call instructions,
+     but 0xf84f and TRAP #15 are left to the system ROM.  */
+  for (unsigned int op = 0xf000u; op != 0x10000u; ++op)
+    if (op != 0xf84fu)
+      eu.set_instruction(op, make_pair(&line_f, 0UL));
+  for (unsigned int op = 0x4e40u; op != 0x4e4fu; ++op)
+    eu.set_instruction(op, make_pair(&trap, 0UL));
+
   uint32_type pc = 0x2000;
  rerun:
   try
     {
       pc = eu.run(pc, c);
     }
-  catch (illegal_instruction_exception &e)
-    {
-      pc = e.pc();
-      uint16_type op = c.mem->get_16(pc, memory::SUPER_DATA);
-
-      if ((op & 0xf000u) == 0xf000u)
-	{
-	  uint16_type oldsr = c.sr();
-	  c.set_supervisor_state(true);
-	  c.regs.a[7] -= 6;
-	  c.mem->put_32(c.regs.a[7] + 2, pc, memory::SUPER_DATA);
-	  c.mem->put_16(c.regs.a[7] + 0, oldsr, memory::SUPER_DATA);
-	  pc = c.mem->get_32(11u * 4u, memory::SUPER_DATA);
-	  goto rerun;
-	}
-      else if ((op & 0xfff0u) == 0x4e40)
-	{
-	  pc += 2;
-
-	  uint16_type oldsr = c.sr();
-	  c.set_supervisor_state(true);
-	  c.regs.a[7] -= 6;
-	  c.mem->put_32(c.regs.a[7] + 2, pc, memory::SUPER_DATA);
-	  c.mem->put_16(c.regs.a[7] + 0, oldsr, memory::SUPER_DATA);
-	  pc = c.mem->get_32(((op & 0xfu) + 32) * 4u, memory::SUPER_DATA);
-	  goto rerun;
-	}
-
-      throw;
-    }
   catch (memory_exception &e)
     {
       uint32_type vecaddr = e.vecno() * 4u;
@@ -250,6 +260,13 @@ machine::boot()
 
 void
 machine::queue_key(uint16_type key)
+{
+  external_event e = {external_event::KEY, key, 0};
+  post_event(e);
+}
+
+void
+machine::push_key(uint16_type key)
 {
   mutex_lock lock(&key_queue_mutex);
 
@@ -280,6 +297,18 @@ machine::peek_key()
 uint16_type
 machine::get_key()
 {
+  // Waiting is a step, as the key comes with an external event.
+  while (_event_mode != LIVE_EVENTS)
+    {
+      {
+	mutex_lock lock(&key_queue_mutex);
+	if (!key_queue.empty())
+	  break;
+      }
+      ++_step_count;
+      deliver_events(true);
+    }
+
   mutex_lock lock(&key_queue_mutex);
 
   while (key_queue.empty())
@@ -294,7 +323,22 @@ machine::get_key()
 void
 machine::set_key_modifiers(uint16_type mask, uint16_type value)
 {
-  _key_modifiers = (_key_modifiers & ~mask) ^ value;
+  external_event e = {external_event::KEY_MODIFIERS, mask, value};
+  post_event(e);
+}
+
+void
+machine::set_mouse_state(unsigned int i, bool s)
+{
+  external_event e = {external_event::MOUSE_STATE, i, s};
+  post_event(e);
+}
+
+void
+machine::set_mouse_position(int x, int y)
+{
+  external_event e = {external_event::MOUSE_POSITION, x, y};
+  post_event(e);
 }
 
 void
@@ -387,70 +431,241 @@ machine::update_image(unsigned char *rgb_buf, size_t row_size,
 void
 machine::check_timers(uint32_type t)
 {
-  crtc.check_timeouts(t, *master_context());
-  opm.check_timeouts(t, *master_context());
-  scc.track_mouse();
-  last_check_time = t;
+  uint32_type g;
+  {
+    mutex_lock lock(&clock_mutex);
+
+    last_host_time = t;
+    if (_speed == 0)
+      {
+	// At least as fast as the host, and one event per check.
+	g = guest_base_time + (t - host_base_time);
+	uint32_type next;
+	if (scheduler.next_event_time(next) && sint32_type(next - g) > 0)
+	  {
+	    guest_base_time += next - g;
+	    g = next;
+	  }
+      }
+    else
+      g = guest_base_time + (t - host_base_time) * _speed;
+  }
+
+  if (_event_mode == LIVE_EVENTS)
+    scheduler.run(g, *master_context());
+  else
+    {
+      external_event e = {external_event::CLOCK, g - start_guest_time, 0};
+      post_event(e);
+    }
+
+  if (_profile != NULL)
+    _profile->sample();
+}
+
+void
+machine::set_profile(execution_profile *p)
+{
+  _profile = p;
+  rom.set_profile(p);
+  update_hooks();
+}
+
+void
+machine::add_hooked_instructions(hooked_instructions *s)
+{
+  I(s != NULL);
+  hooked_sets.push_back(s);
+  s->set_instructions(eu, _hooked);
+}
+
+void
+machine::remove_hooked_instructions(hooked_instructions *s)
+{
+  hooked_sets.erase(remove(hooked_sets.begin(), hooked_sets.end(), s),
+		    hooked_sets.end());
+}
+
+void
+machine::update_hooks()
+{
+  bool h = (_event_mode != LIVE_EVENTS || checkpoint_fildes != -1
+	    || _profile != NULL);
+  if (h == _hooked)
+    return;
+
+  _hooked = h;
+  rom.set_hooked(h);
+  for (vector<hooked_instructions *>::iterator i = hooked_sets.begin();
+       i != hooked_sets.end();
+       ++i)
+    (*i)->set_instructions(eu, h);
+}
+
+void
+machine::set_speed(unsigned int n)
+{
+  mutex_lock lock(&clock_mutex);
+
+  guest_base_time = scheduler.current_time();
+  host_base_time = last_host_time;
+  _speed = n;
+}
+
+time_t
+machine::calendar_time() const
+{
+  return start_calendar_time + guest_time() / 1000;
+}
+
+void
+machine::idle()
+{
+  uint32_type g;
+  {
+    mutex_lock lock(&clock_mutex);
+
+    if (_speed != 0 || !scheduler.next_event_time(g))
+      return;
+
+    uint32_type now = scheduler.current_time();
+    if (sint32_type(g - now) <= 0)
+      return;
+    guest_base_time += g - now;
+  }
+
+  // Recorded and replayed like the clock events of check_timers.
+  if (_event_mode == LIVE_EVENTS)
+    scheduler.run(g, *master_context());
+  else
+    {
+      external_event e = {external_event::CLOCK, g - start_guest_time, 0};
+      post_event(e);
+    }
 }
 
 void
 machine::connect(console *c)
 {
   console::time_type t = c->current_time();
+  {
+    mutex_lock lock(&clock_mutex);
+
+    host_base_time = t;
+    guest_base_time = t;
+    last_host_time = t;
+    start_calendar_time = time(NULL);
+    start_guest_time = t;
+  }
+  scheduler.run(t, *master_context());
+
   crtc.reset(t);
   opm.reset(t);
+  scc.reset(t);
   tvram.connect(c);
   font.copy_data(c);
 }
 
+namespace
+{
+  /* Fills AS from FIRST to LAST with memory M, and records the range
+     as mapped if AS is an X68000 address space.  */
+  void
+  map_memory(memory_map &as, uint32_type first, uint32_type last, memory *m)
+  {
+    as.fill(first, last, m);
+    x68k_address_space *xas = dynamic_cast<x68k_address_space *>(&as);
+    if (xas != NULL)
+      xas->set_mapped(first, last, m);
+  }
+} // (unnamed namespace)
+
 void
 machine::configure(memory_map &as)
 {
-  as.fill(0, _memory_size, &mem);
-  as.fill(0xc00000, 0xe00000, &gv);
-  as.fill(0xe00000, 0xe80000, &tvram);
-  as.fill(0xe80000, 0xe82000, &crtc);
-  as.fill(0xe82000, 0xe84000, &palettes);
-  as.fill(0xe84000, 0xe86000, &dmac);
-  as.fill(0xe86000, 0xe88000, &_area_set);
-  as.fill(0xe88000, 0xe8a000, &mfp);
-  as.fill(0xe8e000, 0xe90000, &system_ports);
-  as.fill(0xe90000, 0xe92000, &opm);
-  as.fill(0xe92000, 0xe94000, &adpcm);
-  as.fill(0xe94000, 0xe96000, &fdc);
-  as.fill(0xe98000, 0xe9a000, &scc);
-  as.fill(0xe9a000, 0xe9c000, &ppi);
-  as.fill(0xeb0000, 0xeb8000, &sprites);
-  as.fill(0xed0000, 0xed4000, &_sram);
-  as.fill(0xf00000, 0xfc0000, &font);
-  as.fill(0xfc0000, 0x1000000, &rom);
+  map_memory(as, 0, _memory_size, &mem);
+  x68k_address_space *xas = dynamic_cast<x68k_address_space *>(&as);
+  if (xas != NULL)
+    xas->map_direct(0, _memory_size, &mem);
+  map_memory(as, 0xc00000, 0xe00000, &gv);
+  map_memory(as, 0xe00000, 0xe80000, &tvram);
+  map_memory(as, 0xe80000, 0xe82000, &crtc);
+  map_memory(as, 0xe82000, 0xe84000, &palettes);
+  map_memory(as, 0xe84000, 0xe86000, &dmac);
+  map_memory(as, 0xe86000, 0xe88000, &_area_set);
+  map_memory(as, 0xe88000, 0xe8a000, &mfp);
+  map_memory(as, 0xe8e000, 0xe90000, &system_ports);
+  map_memory(as, 0xe90000, 0xe92000, &opm);
+  map_memory(as, 0xe92000, 0xe94000, &adpcm);
+  map_memory(as, 0xe94000, 0xe96000, &fdc);
+  map_memory(as, 0xe98000, 0xe9a000, &scc);
+  map_memory(as, 0xe9a000, 0xe9c000, &ppi);
+  map_memory(as, 0xeb0000, 0xeb8000, &sprites);
+  map_memory(as, 0xed0000, 0xed4000, &_sram);
+  map_memory(as, 0xf00000, 0xfc0000, &font);
+  map_memory(as, 0xfc0000, 0x1000000, &rom);
+
+  if (xas != NULL)
+    for (vector<watchpoint>::const_iterator i = watchpoints.begin();
+	 i != watchpoints.end(); ++i)
+      xas->watch(i->first, i->last);
 
   rom.initialize(as);
 }
 
 machine::~machine()
 {
+  stop_checkpoints();
+
   for (iocs::disk **i = fd + 0; i != fd + NFDS; ++i)
     delete *i;
 
   rom.detach(&eu);
 
+  pthread_mutex_destroy(&pending_events_mutex);
+  pthread_cond_destroy(&pending_events_not_empty);
+  pthread_mutex_destroy(&clock_mutex);
   pthread_mutex_destroy(&key_queue_mutex);
   pthread_cond_destroy(&key_queue_not_empty);
 }
 
-machine::machine(size_t memory_size)
+machine::machine(size_t memory_size, const char *sram_file_name,
+		 const char *memory_file_name)
   : _memory_size(memory_size),
-    mem(memory_size),
+    mem(memory_size, memory_file_name),
+    crtc(&scheduler),
     _area_set(&mem),
+    opm(&scheduler),
+    scc(&scheduler),
+    _sram(sram_file_name),
+    watch_trace(NULL),
+    watched_context(NULL),
     master_as(new x68k_address_space(this)),
     _master_context(new context(master_as.get())),
     _key_modifiers(0),
     curx(0), cury(0),
-    saved_byte1(0)
+    saved_byte1(0),
+    _profile(NULL),
+    _hooked(false),
+    _speed(1),
+    host_base_time(0), guest_base_time(0),
+    last_host_time(0),
+    start_calendar_time(time(NULL)),
+    start_guest_time(0),
+    checkpoint_fildes(-1),
+    last_checkpoint_time(0),
+    checkpoint_writer(0),
+    _checkpoint_stats(),
+    _event_mode(LIVE_EVENTS),
+    _step_count(0),
+    event_file(NULL),
+    has_next_event(false)
 {
   pthread_cond_init(&key_queue_not_empty, NULL);
   pthread_mutex_init(&key_queue_mutex, NULL);
+  pthread_mutex_init(&clock_mutex, NULL);
+  pthread_cond_init(&pending_events_not_empty, NULL);
+  pthread_mutex_init(&pending_events_mutex, NULL);
 
   fill(fd + 0, fd + NFDS, (iocs::disk *) NULL);
 
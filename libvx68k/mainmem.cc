@@ -0,0 +1,427 @@
+/* Virtual X68000 - X68000 virtual machine
+   Copyright (C) 1998-2002 Hypercore Software Design, Ltd.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#undef const
+#undef inline
+
+#include <vx68k/memory.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <new>
+
+#ifdef HAVE_NANA_H
+# include <nana.h>
+# include <cstdio>
+#else
+# include <cassert>
+# define I assert
+#endif
+
+using vx68k::main_memory;
+using vx68k::MEMORY_PAGE_SIZE;
+using vm68k::bus_error;
+using namespace vm68k::types;
+using namespace std;
+
+namespace
+{
+  /* Alignment of anonymous main memory, so that the host can back it
+     with huge pages.  */
+  const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+  /* Maps N bytes of zero-filled memory aligned to HUGE_PAGE_SIZE.  */
+  void *
+  map_anonymous(size_t n)
+  {
+    size_t len = n + HUGE_PAGE_SIZE;
+    void *p = mmap(0, len, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      throw bad_alloc();
+
+    // Trims the slack around the aligned range.
+    char *base = static_cast<char *>(p);
+    size_t head = (HUGE_PAGE_SIZE - size_t(base) % HUGE_PAGE_SIZE)
+      % HUGE_PAGE_SIZE;
+    size_t tail = len - head - n;
+    tail -= tail % size_t(sysconf(_SC_PAGESIZE));
+    if (head != 0)
+      munmap(base, head);
+    if (tail != 0)
+      munmap(base + len - tail, tail);
+
+    return base + head;
+  }
+
+  /* Maps N bytes of FILE_NAME, which is extended as needed.  */
+  void *
+  map_file(const char *file_name, size_t n)
+  {
+    int fildes = open(file_name, O_RDWR | O_CREAT, 0666);
+    if (fildes == -1)
+      throw runtime_error(file_name);
+
+    struct stat st;
+    if (fstat(fildes, &st) == -1
+	|| (st.st_size < off_t(n) && ftruncate(fildes, n) == -1))
+      {
+	close(fildes);
+	throw runtime_error(file_name);
+      }
+
+    void *p = mmap(0, n, PROT_READ | PROT_WRITE, MAP_SHARED, fildes, 0);
+    close(fildes);
+    if (p == MAP_FAILED)
+      throw runtime_error(file_name);
+
+    return p;
+  }
+
+  /* Loads and stores at byte offset I of main memory contents DATA.
+     Words and long words are at even offsets.  */
+#ifdef MAIN_MEMORY_GUEST_ORDER
+  // Compilers turn these into byte-swapping loads and stores.
+
+  inline int
+  load_8(const unsigned short *data, uint32_type i)
+  {
+    return reinterpret_cast<const unsigned char *>(data)[i];
+  }
+
+  inline uint16_type
+  load_16(const unsigned short *data, uint32_type i)
+  {
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    return p[i] << 8 | p[i + 1];
+  }
+
+  inline uint32_type
+  load_32(const unsigned short *data, uint32_type i)
+  {
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    return (uint32_type(p[i]) << 24 | uint32_type(p[i + 1]) << 16
+	    | uint32_type(p[i + 2]) << 8 | p[i + 3]);
+  }
+
+  inline void
+  store_8(unsigned short *data, uint32_type i, int value)
+  {
+    reinterpret_cast<unsigned char *>(data)[i] = value;
+  }
+
+  inline void
+  store_16(unsigned short *data, uint32_type i, uint16_type value)
+  {
+    unsigned char *p = reinterpret_cast<unsigned char *>(data);
+    p[i] = value >> 8 & 0xff;
+    p[i + 1] = value & 0xff;
+  }
+
+  inline void
+  store_32(unsigned short *data, uint32_type i, uint32_type value)
+  {
+    unsigned char *p = reinterpret_cast<unsigned char *>(data);
+    p[i] = value >> 24 & 0xff;
+    p[i + 1] = value >> 16 & 0xff;
+    p[i + 2] = value >> 8 & 0xff;
+    p[i + 3] = value & 0xff;
+  }
+#else /* not MAIN_MEMORY_GUEST_ORDER */
+  inline int
+  load_8(const unsigned short *data, uint32_type i)
+  {
+    if (i % 2 != 0)
+      return data[i / 2] & 0xff;
+    else
+      return data[i / 2] >> 8;
+  }
+
+  inline uint16_type
+  load_16(const unsigned short *data, uint32_type i)
+  {
+    return data[i / 2];
+  }
+
+  inline uint32_type
+  load_32(const unsigned short *data, uint32_type i)
+  {
+    return uint32_type(data[i / 2]) << 16 | data[i / 2 + 1];
+  }
+
+  inline void
+  store_8(unsigned short *data, uint32_type i, int value)
+  {
+    if (i % 2 != 0)
+      data[i / 2] = data[i / 2] & 0xff00 | value;
+    else
+      data[i / 2] = data[i / 2] & 0xff | value << 8;
+  }
+
+  inline void
+  store_16(unsigned short *data, uint32_type i, uint16_type value)
+  {
+    data[i / 2] = value & 0xffff;
+  }
+
+  inline void
+  store_32(unsigned short *data, uint32_type i, uint32_type value)
+  {
+    data[i / 2] = value >> 16 & 0xffff;
+    data[i / 2 + 1] = value & 0xffff;
+  }
+#endif /* not MAIN_MEMORY_GUEST_ORDER */
+} // (unnamed namespace)
+
+int
+main_memory::get_8(uint32_type address, function_code fc) const
+  throw (memory_exception)
+{
+  uint32_type i = address & 0xffffff;
+  if (i >= end)
+    throw bus_error(address, READ | fc);
+
+  return load_8(data, i);
+}
+
+uint16_type
+main_memory::get_16(uint32_type address, function_code fc) const
+  throw (memory_exception)
+{
+  I(address % 2 == 0);
+  uint32_type i = address & 0xffffff;
+  if (i >= end)
+    throw bus_error(address, READ | fc);
+
+  return load_16(data, i);
+}
+
+uint32_type
+main_memory::get_32(uint32_type address, function_code fc) const
+  throw (memory_exception)
+{
+  I(address % 2 == 0);
+  uint32_type i = address & 0xffffff;
+  if (i + 4 > end)
+    throw bus_error(address, READ | fc);
+
+  return load_32(data, i);
+}
+
+void
+main_memory::put_8(uint32_type address, int value, function_code fc)
+  throw (memory_exception)
+{
+  value &= 0xff;
+
+  uint32_type i = address & 0xffffff;
+  if (i >= end || fc != SUPER_DATA && i < super_area)
+    throw bus_error(address, WRITE | fc);
+
+  page_marks[i / MEMORY_PAGE_SIZE] = true;
+
+  store_8(data, i, value);
+}
+
+void
+main_memory::put_16(uint32_type address, uint16_type value, function_code fc)
+  throw (memory_exception)
+{
+  I(address % 2 == 0);
+  uint32_type i = address & 0xffffff;
+  if (i >= end || fc != SUPER_DATA && i < super_area)
+    throw bus_error(address, WRITE | fc);
+
+  page_marks[i / MEMORY_PAGE_SIZE] = true;
+
+  store_16(data, i, value);
+}
+
+void
+main_memory::put_32(uint32_type address, uint32_type value, function_code fc)
+  throw (memory_exception)
+{
+  I(address % 2 == 0);
+  uint32_type i = address & 0xffffff;
+  if (i + 4 > end || fc != SUPER_DATA && i < super_area)
+    throw bus_error(address, WRITE | fc);
+
+  // A long word at an odd word address may cross a page boundary.
+  page_marks[i / MEMORY_PAGE_SIZE] = true;
+  page_marks[(i + 2) / MEMORY_PAGE_SIZE] = true;
+
+  store_32(data, i, value);
+}
+
+void
+main_memory::set_super_area(size_t n)
+{
+  super_area = n;
+}
+
+bool
+main_memory::page_modified(uint32_type address) const
+{
+  uint32_type i = address & 0xffffff;
+  if (i >= end)
+    return false;
+
+  return page_marks[i / MEMORY_PAGE_SIZE];
+}
+
+void
+main_memory::take_page_marks(vector<bool> &marks)
+{
+  marks.assign(page_marks.size(), false);
+  marks.swap(page_marks);
+}
+
+void
+main_memory::merge_page_marks(const vector<bool> &marks)
+{
+  I(marks.size() == page_marks.size());
+  for (vector<bool>::size_type i = 0; i != marks.size(); ++i)
+    if (marks[i])
+      page_marks[i] = true;
+}
+
+void
+main_memory::mark_all_pages()
+{
+  std::fill(page_marks.begin(), page_marks.end(), true);
+}
+
+void
+main_memory::mark_pages(uint32_type i, uint32_type n)
+{
+  if (n == 0)
+    return;
+
+  I(i < end && n <= end - i);
+  std::fill(page_marks.begin() + i / MEMORY_PAGE_SIZE,
+	    page_marks.begin() + (i + n - 1) / MEMORY_PAGE_SIZE + 1, true);
+}
+
+bool
+main_memory::copy(uint32_type dest, uint32_type src, uint32_type n,
+		  function_code fc)
+{
+  uint32_type d = dest & 0xffffff;
+  uint32_type s = src & 0xffffff;
+  if (d > end || n > end - d || s > end || n > end - s
+      || fc != SUPER_DATA && d < super_area)
+    return false;
+
+  mark_pages(d, n);
+
+  // An overlapping copy to a higher address must repeat the source
+  // pattern as the byte loop does, so it cannot go by words.
+  if (d % 2 == 0 && s % 2 == 0 && (d <= s || d >= s + n))
+    {
+      memmove(data + d / 2, data + s / 2, n / 2 * 2);
+      if (n % 2 != 0)
+	store_8(data, d + n - 1, load_8(data, s + n - 1));
+    }
+  else
+    {
+      for (uint32_type k = 0; k != n; ++k)
+	store_8(data, d + k, load_8(data, s + k));
+    }
+
+  return true;
+}
+
+bool
+main_memory::fill(uint32_type address, int value, uint32_type n,
+		  function_code fc)
+{
+  value &= 0xff;
+
+  uint32_type i = address & 0xffffff;
+  if (i > end || n > end - i || fc != SUPER_DATA && i < super_area)
+    return false;
+
+  mark_pages(i, n);
+
+  // A word of two equal bytes is the same in either layout.
+  uint32_type e = i + n;
+  if (i != e && i % 2 != 0)
+    store_8(data, i++, value);
+  std::fill(data + i / 2, data + e / 2, value << 8 | value);
+  if (e % 2 != 0 && e - 1 >= i)
+    store_8(data, e - 1, value);
+
+  return true;
+}
+
+bool
+main_memory::find(uint32_type address, int value, uint32_type &found) const
+{
+  value &= 0xff;
+
+  uint32_type start = address & 0xffffff;
+  for (uint32_type i = start; i < end; ++i)
+    if (load_8(data, i) == value)
+      {
+	found = address + (i - start);
+	return true;
+      }
+
+  return false;
+}
+
+main_memory::~main_memory()
+{
+  munmap(data, end);
+}
+
+main_memory::main_memory(size_t n, const char *file_name)
+  : end((n + 1) / 2 * 2),
+    super_area(0),
+    data(NULL),
+    page_marks((end + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE, true)
+{
+  if (file_name != NULL)
+    data = static_cast<unsigned short *>(map_file(file_name, end));
+  else
+    {
+      data = static_cast<unsigned short *>(map_anonymous(end));
+#ifdef MADV_HUGEPAGE
+      // Only a hint; the memory works without huge pages.
+      madvise(data, end, MADV_HUGEPAGE);
+#endif
+#ifdef FILL_MAIN_MEMORY
+      // These ILLEGAL instructions makes debugging easy, but touch
+      // every page.
+      for (uint32_type i = 0; i != end; i += 2)
+	store_16(data, i, 0x4afc);
+#endif
+    }
+}
@@ -63,9 +63,8 @@ mfp_memory::get_8(uint32_type address, function_code fc) const
   static bool once;
   if (!once++)
     fprintf(stderr, "class mfp_memory: FIXME: `get_8' not implemented\n");
-  static unsigned int v = 0xfb;
-  v ^= 0x90;
-  return v;
+  toggle_value ^= 0x90;
+  return toggle_value;
 }
 
 void
@@ -95,3 +94,8 @@ mfp_memory::put_8(uint32_type address, int value, function_code fc)
   if (!once++)
     fprintf(stderr, "class mfp_memory: FIXME: `put_8' not implemented\n");
 }
+
+mfp_memory::mfp_memory()
+  : toggle_value(0xfb)
+{
+}
@@ -41,41 +41,69 @@ using namespace std;
 void
 opm_memory::reset(console::time_type t)
 {
-  last_check_time = t;
+  mutex_lock lock(&mutex);
+
+  timer_a_start_time = t;
+  timer_b_start_time = t;
+  schedule_timers();
 }
 
 void
-opm_memory::check_timeouts(console::time_type t, context &c)
+opm_memory::schedule_timers()
 {
-  mutex_lock lock(&mutex);
-
-  last_check_time = t;
-
-  unsigned int old_status = status();
   unsigned int tcr = _regs[0x14];
 
-  if ((tcr & 0x1) == 0x1 && (t - timer_a_start_time) >= timer_a_interval)
-    {
-      _status |= 0x2;
-      timer_a_start_time += timer_a_interval;
-    }
-  if ((tcr & 0x2) == 0x2 && (t - timer_b_start_time) >= timer_b_interval)
+  if ((tcr & 0x3) == 0)
+    _scheduler->cancel(this);
+  else
     {
-      _status |= 0x1;
-      timer_a_start_time += timer_b_interval;
+      console::time_type a = timer_a_start_time + timer_a_interval;
+      console::time_type b = timer_b_start_time + timer_b_interval;
+      if ((tcr & 0x3) == 0x1)
+	_scheduler->schedule(this, a);
+      else if ((tcr & 0x3) == 0x2)
+	_scheduler->schedule(this, b);
+      else
+	_scheduler->schedule(this, sint32_type(a - b) < 0 ? a : b);
     }
+}
 
-  if (interrupt_enabled())
-    {
-      unsigned int set_status = status() - ~old_status;
-      if ((tcr & 0x4) == 0x4 && (set_status & 0x2) == 0x2
-	  || (tcr & 0x8) == 0x8 && (set_status & 0x1) == 0x1)
-	{
-	  c.interrupt(6, 0x43);
-	}
-    }
+void
+opm_memory::process_event(console::time_type t, context &c)
+{
+  bool raised = false;
+  {
+    mutex_lock lock(&mutex);
+
+    unsigned int old_status = status();
+    unsigned int tcr = _regs[0x14];
+
+    if ((tcr & 0x1) == 0x1 && (t - timer_a_start_time) >= timer_a_interval)
+      {
+	_status |= 0x2;
+	timer_a_start_time += timer_a_interval;
+      }
+    if ((tcr & 0x2) == 0x2 && (t - timer_b_start_time) >= timer_b_interval)
+      {
+	_status |= 0x1;
+	timer_b_start_time += timer_b_interval;
+      }
+    schedule_timers();
+
+    if (interrupt_enabled())
+      {
+	unsigned int set_status = status() - ~old_status;
+	if ((tcr & 0x4) == 0x4 && (set_status & 0x2) == 0x2
+	    || (tcr & 0x8) == 0x8 && (set_status & 0x1) == 0x1)
+	  raised = true;
+      }
+  }
+
+  // See crtc_memory::process_event.
+  if (raised)
+    c.interrupt(6, 0x43);
 }
-
+
 void
 opm_memory::set_reg(int regno, int value)
 {
@@ -92,7 +120,11 @@ opm_memory::set_reg(int regno, int value)
       {
 	unsigned int k = _regs[0x10] << 2 | _regs[0x11] & 0x3;
 	timer_a_interval = (0x400 - k) * 64 / 4000;
-	timer_a_start_time = last_check_time;
+	// A zero interval would keep the scheduler busy forever.
+	if (timer_a_interval == 0)
+	  timer_a_interval = 1;
+	timer_a_start_time = _scheduler->current_time();
+	schedule_timers();
       }
       break;
 
@@ -100,7 +132,10 @@ opm_memory::set_reg(int regno, int value)
       {
 	unsigned int k = _regs[0x12];
 	timer_b_interval = (0x100 - k) * 1024 / 4000;
-	timer_b_start_time = last_check_time;
+	if (timer_b_interval == 0)
+	  timer_b_interval = 1;
+	timer_b_start_time = _scheduler->current_time();
+	schedule_timers();
       }
       break;
 
@@ -110,6 +145,7 @@ opm_memory::set_reg(int regno, int value)
 	  _status &= ~0x2;
 	if ((value & 0x20) == 0x20)
 	  _status &= ~0x1;
+	schedule_timers();
       }
       break;
 
@@ -117,7 +153,7 @@ opm_memory::set_reg(int regno, int value)
       break;
     }
 }
-
+
 void
 opm_memory::set_interrupt_enabled(bool value)
 {
@@ -215,10 +251,15 @@ opm_memory::~opm_memory()
   pthread_mutex_destroy(&mutex);
 }
 
-opm_memory::opm_memory()
-  : _status(0),
+opm_memory::opm_memory(event_scheduler *s)
+  : _scheduler(s),
+    _status(0),
     _regs(0x100, 0),
-    _interrupt_enabled(false)
+    _interrupt_enabled(false),
+    timer_a_interval(0x400 * 64 / 4000),
+    timer_b_interval(0x100 * 1024 / 4000),
+    timer_a_start_time(0),
+    timer_b_start_time(0)
 {
   reg_index = 0;
 
@@ -0,0 +1,159 @@
+/* Virtual X68000 - X68000 virtual machine
+   Copyright (C) 1998-2002 Hypercore Software Design, Ltd.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#undef const
+#undef inline
+
+#include <vx68k/machine.h>
+#include <vm68k/mutex.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#ifdef HAVE_NANA_H
+# include <nana.h>
+#else
+# include <cassert>
+# define I assert
+#endif
+
+using vx68k::execution_profile;
+using vm68k::mutex_lock;
+using namespace vm68k::types;
+using namespace std;
+
+namespace
+{
+  /* Number of entries in each part of a report.  */
+  const size_t REPORT_ENTRIES = 10;
+
+  typedef pair<unsigned long, uint32_type> count_type;
+
+  /* Writes the largest non-zero entries of COUNTS with their share
+     of TOTAL.  */
+  void
+  report_counts(FILE *out, vector<count_type> &counts, unsigned long total,
+		const char *format)
+  {
+    size_t n = min(counts.size(), REPORT_ENTRIES);
+    partial_sort(counts.begin(), counts.begin() + n, counts.end(),
+		 greater<count_type>());
+
+    for (vector<count_type>::const_iterator i = counts.begin();
+	 i != counts.begin() + n && i->first != 0;
+	 ++i)
+      {
+	fprintf(out, format, (unsigned long) i->second);
+	fprintf(out, " %10lu %5.1f%%\n",
+		i->first, total != 0 ? 100. * i->first / total : 0.);
+      }
+  }
+
+  /* Returns the counts in V paired with their indices plus BASE.  */
+  vector<count_type>
+  indexed_counts(const vector<unsigned long> &v, uint32_type base)
+  {
+    vector<count_type> counts;
+    for (vector<unsigned long>::size_type i = 0; i != v.size(); ++i)
+      counts.push_back(make_pair(v[i], base + i));
+    return counts;
+  }
+} // (unnamed namespace)
+
+void
+execution_profile::set_sampled_context(const context *c)
+{
+  mutex_lock lock(&mutex);
+
+  sampled_context = c;
+}
+
+void
+execution_profile::sample()
+{
+  mutex_lock lock(&mutex);
+
+  if (sampled_context == NULL)
+    return;
+
+  ++state_samples[current_state];
+  if (current_state == INSTRUCTIONS)
+    ++pc_range_samples[sampled_context->regs.pc / PC_RANGE_SIZE];
+}
+
+void
+execution_profile::report(FILE *out) const
+{
+  mutex_lock lock(&mutex);
+
+  unsigned long iocs_calls = 0;
+  for (vector<unsigned long>::const_iterator i = iocs_call_counts.begin();
+       i != iocs_call_counts.end(); ++i)
+    iocs_calls += *i;
+
+  unsigned long dos_calls = 0;
+  for (vector<unsigned long>::const_iterator i = dos_call_counts.begin();
+       i != dos_call_counts.end(); ++i)
+    dos_calls += *i;
+
+  fprintf(out, "IOCS calls: %lu\n", iocs_calls);
+  vector<count_type> counts = indexed_counts(iocs_call_counts, 0);
+  report_counts(out, counts, iocs_calls, "  0x%02lx    ");
+
+  fprintf(out, "DOS calls: %lu\n", dos_calls);
+  counts = indexed_counts(dos_call_counts, 0xff00);
+  report_counts(out, counts, dos_calls, "  0x%04lx  ");
+
+  unsigned long samples = 0;
+  for (const unsigned long *i = state_samples + 0;
+       i != state_samples + NSTATES; ++i)
+    samples += *i;
+
+  fprintf(out, "PC samples: %lu\n", samples);
+  counts.clear();
+  for (map<uint32_type, unsigned long>::const_iterator i
+	 = pc_range_samples.begin();
+       i != pc_range_samples.end(); ++i)
+    counts.push_back(make_pair(i->second, i->first * PC_RANGE_SIZE));
+  report_counts(out, counts, samples, "  0x%08lx");
+
+  if (samples != 0)
+    fprintf(out, "Instructions %.1f%%, IOCS calls %.1f%%, DOS calls %.1f%%\n",
+	    100. * state_samples[INSTRUCTIONS] / samples,
+	    100. * state_samples[IOCS_CALL] / samples,
+	    100. * state_samples[DOS_CALL] / samples);
+}
+
+execution_profile::~execution_profile()
+{
+  pthread_mutex_destroy(&mutex);
+}
+
+execution_profile::execution_profile()
+  : iocs_call_counts(0x100, 0),
+    dos_call_counts(0x100, 0),
+    current_state(INSTRUCTIONS),
+    sampled_context(NULL)
+{
+  fill(state_samples + 0, state_samples + NSTATES, 0);
+
+  pthread_mutex_init(&mutex, NULL);
+}
@@ -43,6 +43,9 @@ using namespace std;
 extern bool nana_iocs_call_trace;
 #endif
 
+/* Interval of mouse sampling in milliseconds.  */
+const unsigned int MOUSE_SAMPLE_INTERVAL = 10;
+
 bool
 scc_memory::mouse_state(unsigned int button) const
 {
@@ -110,6 +113,19 @@ scc_memory::track_mouse()
   old_mouse_position = _mouse_position;
 }
 
+void
+scc_memory::reset(console::time_type t)
+{
+  _scheduler->schedule(this, t + MOUSE_SAMPLE_INTERVAL);
+}
+
+void
+scc_memory::process_event(console::time_type t, context &)
+{
+  track_mouse();
+  _scheduler->schedule(this, t + MOUSE_SAMPLE_INTERVAL);
+}
+
 void
 scc_memory::set_mouse_bounds(int l, int t, int r, int b)
 {
@@ -370,8 +386,9 @@ scc_memory::~scc_memory()
   pthread_mutex_destroy(&mutex);
 }
 
-scc_memory::scc_memory()
-  : mouse_left(0), mouse_top(0), mouse_right(768), mouse_bottom(512),
+scc_memory::scc_memory(event_scheduler *s)
+  : _scheduler(s),
+    mouse_left(0), mouse_top(0), mouse_right(768), mouse_bottom(512),
     mouse_states(2, false)
 {
   pthread_mutex_init(&mutex, 0);
@@ -0,0 +1,120 @@
+/* Virtual X68000 - X68000 virtual machine
+   Copyright (C) 1998-2002 Hypercore Software Design, Ltd.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#undef const
+#undef inline
+
+#include <vx68k/memory.h>
+#include <vm68k/mutex.h>
+
+#ifdef HAVE_NANA_H
+# include <nana.h>
+# include <cstdio>
+#else
+# include <cassert>
+# define I assert
+#endif
+
+using vx68k::event_scheduler;
+using vx68k::timed_device;
+using vm68k::mutex_lock;
+using namespace vm68k::types;
+using namespace std;
+
+void
+event_scheduler::schedule(timed_device *d, time_type t)
+{
+  I(d != NULL);
+  mutex_lock lock(&mutex);
+
+  due_times[d] = t;
+  events.push(make_pair(t, d));
+}
+
+void
+event_scheduler::cancel(timed_device *d)
+{
+  mutex_lock lock(&mutex);
+
+  due_times.erase(d);
+}
+
+bool
+event_scheduler::next_event_time(time_type &t) const
+{
+  mutex_lock lock(&mutex);
+
+  // The top may be stale, which only makes the result early.
+  if (events.empty())
+    return false;
+
+  t = events.top().first;
+  return true;
+}
+
+void
+event_scheduler::advance(time_type t)
+{
+  // Events scheduled in the past and late runs keep the current time.
+  if (sint32_type(t - _current_time) > 0)
+    _current_time = t;
+}
+
+void
+event_scheduler::run(time_type t, context &c)
+{
+  for (;;)
+    {
+      event e;
+      {
+	mutex_lock lock(&mutex);
+
+	if (events.empty() || sint32_type(t - events.top().first) < 0)
+	  {
+	    advance(t);
+	    return;
+	  }
+
+	e = events.top();
+	events.pop();
+
+	map<timed_device *, time_type>::iterator found
+	  = due_times.find(e.second);
+	if (found == due_times.end() || found->second != e.first)
+	  continue;		// stale
+
+	due_times.erase(found);
+	advance(e.first);
+      }
+
+      e.second->process_event(e.first, c);
+    }
+}
+
+event_scheduler::~event_scheduler()
+{
+  pthread_mutex_destroy(&mutex);
+}
+
+event_scheduler::event_scheduler()
+  : _current_time(0)
+{
+  pthread_mutex_init(&mutex, NULL);
+}
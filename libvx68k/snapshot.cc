@@ -0,0 +1,561 @@
+/* Virtual X68000 - X68000 virtual machine
+   Copyright (C) 1998-2002 Hypercore Software Design, Ltd.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+/* Snapshot files and checkpoints.  All numbers are 32-bit words in
+   host byte order, and a byte order mark in the header rejects files
+   from other hosts or with another main memory layout.
+   A file consists of:
+
+     a header of HEADER_WORDS words;
+     sections, each a tag, a length in bytes and that many bytes of
+     data, which is always a whole number of words;
+     the main memory contents as they are in memory, starting at an offset
+     that is a multiple of SNAPSHOT_ALIGNMENT so that it can be
+     mapped copy-on-write.
+
+   A checkpoint file is a snapshot file that is updated in place:
+   each checkpoint rewrites the header and sections, which have a
+   fixed size, and only the pages of main memory modified since the
+   previous one.  The last word of the header is COMPLETE_MARK only
+   while no update is in progress; it is cleared and synced before an
+   update and set by a final write after the update is synced, so that
+   a torn checkpoint cannot be restored.  */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#undef const
+#undef inline
+
+#include <vx68k/machine.h>
+#include <vm68k/mutex.h>
+
+#include <sys/time.h>
+#include <sys/wait.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+#include <stdexcept>
+#include <cstdlib>
+#include <cerrno>
+
+#ifdef HAVE_NANA_H
+# include <nana.h>
+# include <cstdio>
+#else
+# include <cassert>
+# define I assert
+#endif
+
+using namespace vx68k;
+using namespace vm68k;
+using namespace std;
+
+namespace
+{
+  const uint32_type MAGIC_0 = 0x56583638; // "VX68"
+  const uint32_type MAGIC_1 = 0x4b534e50; // "KSNP"
+  const uint32_type SNAPSHOT_VERSION = 1;
+#if defined MAIN_MEMORY_GUEST_ORDER && !defined WORDS_BIGENDIAN
+  // Main memory is not in the host byte order.
+  const uint32_type BYTE_ORDER_MARK = 0x01020344;
+#else
+  const uint32_type BYTE_ORDER_MARK = 0x01020304;
+#endif
+
+  const size_t HEADER_WORDS = 8;
+  const size_t SNAPSHOT_ALIGNMENT = 0x1000;
+
+  /* Index of the header word that marks a complete file, and its
+     value.  */
+  const size_t COMPLETE_WORD = 7;
+  const uint32_type COMPLETE_MARK = 0x444f4e45; // "DONE"
+
+  const uint32_type CPU_TAG = 0x43505520; // "CPU "
+  const uint32_type MACHINE_TAG = 0x4d414348; // "MACH"
+  const uint32_type CRTC_TAG = 0x43525443; // "CRTC"
+  const uint32_type OPM_TAG = 0x4f504d20; // "OPM "
+  const uint32_type PALETTES_TAG = 0x50414c54; // "PALT"
+  const uint32_type TEXT_VRAM_TAG = 0x5456524d; // "TVRM"
+
+  typedef vector<uint32_type> section;
+
+  /* Returns true if TAG is a section this version restores.  */
+  bool
+  known_tag(uint32_type tag)
+  {
+    switch (tag)
+      {
+      case CPU_TAG:
+      case MACHINE_TAG:
+      case CRTC_TAG:
+      case OPM_TAG:
+      case PALETTES_TAG:
+      case TEXT_VRAM_TAG:
+	return true;
+
+      default:
+	return false;
+      }
+  }
+
+  /* Returns the offset of the main memory contents after N bytes of
+     header and sections.  */
+  inline size_t
+  main_offset(size_t n)
+  {
+    return ((n + SNAPSHOT_ALIGNMENT - 1)
+	    / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT);
+  }
+
+  void
+  write_fully(int fildes, const void *data, size_t n)
+  {
+    const char *p = static_cast<const char *>(data);
+    while (n != 0)
+      {
+	ssize_t written = write(fildes, p, n);
+	if (written == -1)
+	  {
+	    if (errno == EINTR)
+	      continue;
+	    throw runtime_error("snapshot: write failed");
+	  }
+	p += written;
+	n -= written;
+      }
+  }
+
+  void
+  read_fully(int fildes, void *data, size_t n)
+  {
+    char *p = static_cast<char *>(data);
+    while (n != 0)
+      {
+	ssize_t result = read(fildes, p, n);
+	if (result == -1)
+	  {
+	    if (errno == EINTR)
+	      continue;
+	    throw runtime_error("snapshot: read failed");
+	  }
+	if (result == 0)
+	  throw runtime_error("snapshot: file truncated");
+	p += result;
+	n -= result;
+      }
+  }
+
+  /* Shortest interval between checkpoints in milliseconds.  */
+  const uint32_type MIN_CHECKPOINT_INTERVAL = 1000;
+
+  /* Largest share of an interval in percent that the guest may be
+     paused for a checkpoint.  The interval is doubled when a pause
+     takes longer.  */
+  const unsigned long MAX_PAUSE_PERCENT = 1;
+
+  /* Writes N bytes of DATA at OFFSET of FILDES in a checkpoint
+     writer, which may call only async-signal-safe functions.  Exits
+     the process on failure instead of throwing.  */
+  void
+  pwrite_or_exit(int fildes, const void *data, size_t n, off_t offset)
+  {
+    const char *p = static_cast<const char *>(data);
+    while (n != 0)
+      {
+	ssize_t written = pwrite(fildes, p, n, offset);
+	if (written == -1)
+	  {
+	    if (errno == EINTR)
+	      continue;
+	    _exit(EXIT_FAILURE);
+	  }
+	p += written;
+	offset += written;
+	n -= written;
+      }
+  }
+
+  /* Returns the host time in microseconds, modulo the range of
+     unsigned long.  */
+  unsigned long
+  microseconds()
+  {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000UL + tv.tv_usec;
+  }
+
+  /* Appends the words at addresses from FIRST to LAST of memory M,
+     two to a section word.  */
+  void
+  append_words(section &s, const memory &m,
+	       uint32_type first, uint32_type last)
+  {
+    for (uint32_type i = first; i != last; i += 4)
+      s.push_back(m.get_16(i, memory::SUPER_DATA) << 16
+		  | m.get_16(i + 2, memory::SUPER_DATA));
+  }
+
+  /* Restores words appended by append_words.  */
+  void
+  restore_words(const section &s, memory &m,
+		uint32_type first, uint32_type last)
+  {
+    if (s.size() != (last - first) / 4)
+      throw runtime_error("snapshot: bad section size");
+
+    section::const_iterator j = s.begin();
+    for (uint32_type i = first; i != last; i += 4)
+      {
+	m.put_16(i, *j >> 16, memory::SUPER_DATA);
+	m.put_16(i + 2, *j & 0xffff, memory::SUPER_DATA);
+	++j;
+      }
+  }
+} // (unnamed namespace)
+
+void
+machine::encode_snapshot(const context &c, vector<uint32_type> &words) const
+{
+  vector<pair<uint32_type, section> > sections;
+
+  {
+    section s;
+    s.insert(s.end(), c.regs.d + 0, c.regs.d + 8);
+    s.insert(s.end(), c.regs.a + 0, c.regs.a + 8);
+    s.push_back(c.regs.pc);
+    s.push_back(c.regs.usp);
+    s.push_back(c.sr());
+    sections.push_back(make_pair(CPU_TAG, s));
+  }
+  {
+    section s;
+    s.push_back(curx);
+    s.push_back(cury);
+    s.push_back(saved_byte1);
+    s.push_back(_key_modifiers);
+    s.push_back(mem.super_area_size());
+    sections.push_back(make_pair(MACHINE_TAG, s));
+  }
+  {
+    section s;
+    s.push_back(crtc.vdisp_counter_reload());
+    sections.push_back(make_pair(CRTC_TAG, s));
+  }
+  {
+    section s;
+    s.push_back(opm.interrupt_enabled());
+    for (int i = 0; i != 0x100; ++i)
+      s.push_back(opm.reg(i));
+    sections.push_back(make_pair(OPM_TAG, s));
+  }
+  {
+    section s;
+    append_words(s, palettes, 0xe82000, 0xe82400);
+    sections.push_back(make_pair(PALETTES_TAG, s));
+  }
+  {
+    section s;
+    append_words(s, tvram, 0xe00000, 0xe80000);
+    sections.push_back(make_pair(TEXT_VRAM_TAG, s));
+  }
+
+  size_t offset = HEADER_WORDS * 4;
+  for (vector<pair<uint32_type, section> >::const_iterator i
+	 = sections.begin();
+       i != sections.end(); ++i)
+    offset += 8 + i->second.size() * 4;
+
+  uint32_type header[HEADER_WORDS]
+    = {MAGIC_0, MAGIC_1, SNAPSHOT_VERSION, BYTE_ORDER_MARK,
+       _memory_size, main_offset(offset), sections.size(), COMPLETE_MARK};
+
+  words.clear();
+  words.reserve(offset / 4);
+  words.insert(words.end(), header + 0, header + HEADER_WORDS);
+  for (vector<pair<uint32_type, section> >::const_iterator i
+	 = sections.begin();
+       i != sections.end(); ++i)
+    {
+      words.push_back(i->first);
+      words.push_back(i->second.size() * 4);
+      words.insert(words.end(), i->second.begin(), i->second.end());
+    }
+}
+
+void
+machine::save_snapshot(int fildes) const
+{
+  section words;
+  encode_snapshot(*master_context(), words);
+  write_fully(fildes, &words[0], words.size() * 4);
+
+  vector<char> padding(main_offset(words.size() * 4) - words.size() * 4, 0);
+  if (!padding.empty())
+    write_fully(fildes, &padding[0], padding.size());
+
+  write_fully(fildes, mem.contents(), _memory_size);
+}
+
+void
+machine::restore_snapshot(int fildes)
+{
+  uint32_type header[HEADER_WORDS];
+  read_fully(fildes, header, sizeof header);
+  if (header[0] != MAGIC_0 || header[1] != MAGIC_1)
+    throw runtime_error("snapshot: not a snapshot file");
+  if (header[2] != SNAPSHOT_VERSION || header[3] != BYTE_ORDER_MARK)
+    throw runtime_error("snapshot: unsupported version or byte order");
+  if (header[4] != _memory_size)
+    throw runtime_error("snapshot: memory size mismatch");
+  if (header[COMPLETE_WORD] != COMPLETE_MARK)
+    throw runtime_error("snapshot: incomplete checkpoint");
+
+  // Every section must end before the main memory contents, so no
+  // size in the file is trusted further than that.
+  size_t offset = HEADER_WORDS * 4;
+  if (header[5] < offset || header[5] % SNAPSHOT_ALIGNMENT != 0
+      || header[6] > (header[5] - offset) / 8)
+    throw runtime_error("snapshot: bad header");
+
+  for (uint32_type n = 0; n != header[6]; ++n)
+    {
+      uint32_type head[2];
+      if (header[5] - offset < sizeof head)
+	throw runtime_error("snapshot: bad section size");
+      read_fully(fildes, head, sizeof head);
+      offset += sizeof head;
+      if (head[1] % 4 != 0 || head[1] > header[5] - offset)
+	throw runtime_error("snapshot: bad section size");
+      offset += head[1];
+
+      if (!known_tag(head[0]))
+	{
+	  // Sections from later versions are skipped.
+	  if (lseek(fildes, head[1], SEEK_CUR) == -1)
+	    throw runtime_error("snapshot: seek failed");
+	  continue;
+	}
+
+      section s(head[1] / 4);
+      if (!s.empty())
+	read_fully(fildes, &s[0], head[1]);
+
+      switch (head[0])
+	{
+	case CPU_TAG:
+	  {
+	    if (s.size() != 19)
+	      throw runtime_error("snapshot: bad section size");
+	    context *c = master_context();
+	    // SR first, as it may switch the stack pointers.
+	    c->set_sr(s[18]);
+	    copy(s.begin() + 0, s.begin() + 8, c->regs.d + 0);
+	    copy(s.begin() + 8, s.begin() + 16, c->regs.a + 0);
+	    c->regs.pc = s[16];
+	    c->regs.usp = s[17];
+	  }
+	  break;
+
+	case MACHINE_TAG:
+	  if (s.size() != 5)
+	    throw runtime_error("snapshot: bad section size");
+	  curx = s[0];
+	  cury = s[1];
+	  saved_byte1 = s[2];
+	  _key_modifiers = s[3];
+	  mem.set_super_area(s[4]);
+	  break;
+
+	case CRTC_TAG:
+	  if (s.size() != 1)
+	    throw runtime_error("snapshot: bad section size");
+	  crtc.set_vdisp_counter_data(s[0]);
+	  break;
+
+	case OPM_TAG:
+	  if (s.size() != 1 + 0x100)
+	    throw runtime_error("snapshot: bad section size");
+	  for (int i = 0; i != 0x100; ++i)
+	    opm.set_reg(i, s[1 + i]);
+	  opm.set_interrupt_enabled(s[0] != 0);
+	  break;
+
+	case PALETTES_TAG:
+	  restore_words(s, palettes, 0xe82000, 0xe82400);
+	  break;
+
+	case TEXT_VRAM_TAG:
+	  restore_words(s, tvram, 0xe00000, 0xe80000);
+	  break;
+	}
+    }
+
+  if (lseek(fildes, header[5], SEEK_SET) == -1)
+    throw runtime_error("snapshot: seek failed");
+  read_fully(fildes, mem.contents(), _memory_size);
+}
+
+void
+machine::start_checkpoints(int fildes, uint32_type interval)
+{
+  stop_checkpoints();
+
+  // The first checkpoint writes the whole memory.
+  mem.mark_all_pages();
+
+  _checkpoint_stats = checkpoint_stats();
+  _checkpoint_stats.interval = max(interval, MIN_CHECKPOINT_INTERVAL);
+  {
+    mutex_lock lock(&clock_mutex);
+    last_checkpoint_time = last_host_time;
+  }
+  checkpoint_fildes = fildes;
+  update_hooks();
+}
+
+void
+machine::stop_checkpoints()
+{
+  reap_checkpoint_writer(true);
+  checkpoint_fildes = -1;
+  update_hooks();
+}
+
+bool
+machine::reap_checkpoint_writer(bool block)
+{
+  if (checkpoint_writer == 0)
+    return true;
+
+  int status;
+  pid_t pid;
+  do
+    pid = waitpid(checkpoint_writer, &status, block ? 0 : WNOHANG);
+  while (pid == -1 && errno == EINTR);
+  if (pid == 0)
+    return false;
+
+  checkpoint_writer = 0;
+  if (pid == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+      // The next checkpoint must write these pages instead.
+      ++_checkpoint_stats.failed;
+      mem.merge_page_marks(checkpoint_pages);
+    }
+
+  return true;
+}
+
+void
+machine::checkpoint(const context &c)
+{
+  uint32_type t;
+  {
+    mutex_lock lock(&clock_mutex);
+    t = last_host_time;
+  }
+  if (t - last_checkpoint_time < _checkpoint_stats.interval)
+    return;
+  last_checkpoint_time = t;
+
+  if (!reap_checkpoint_writer(false))
+    {
+      ++_checkpoint_stats.skipped;
+      return;
+    }
+
+  unsigned long start = microseconds();
+
+  section words;
+  encode_snapshot(c, words);
+  mem.take_page_marks(checkpoint_pages);
+
+  pid_t pid = fork();
+  if (pid == -1)
+    {
+      ++_checkpoint_stats.failed;
+      mem.merge_page_marks(checkpoint_pages);
+      return;
+    }
+
+  if (pid == 0)
+    {
+      // This process has the memory as it was at the fork.  Another
+      // thread may have held a lock in malloc then, so nothing here
+      // may allocate or throw.
+      size_t base = main_offset(words.size() * 4);
+      const char *contents
+	= reinterpret_cast<const char *>(mem.contents());
+
+      // The file is incomplete until the final write below.
+      uint32_type mark = 0;
+      pwrite_or_exit(checkpoint_fildes, &mark, sizeof mark,
+		     COMPLETE_WORD * 4);
+      if (fsync(checkpoint_fildes) == -1)
+	_exit(EXIT_FAILURE);
+
+      words[COMPLETE_WORD] = 0;
+      pwrite_or_exit(checkpoint_fildes, &words[0], words.size() * 4, 0);
+      vector<bool>::size_type i = 0;
+      while (i != checkpoint_pages.size())
+	{
+	  if (!checkpoint_pages[i])
+	    {
+	      ++i;
+	      continue;
+	    }
+
+	  vector<bool>::size_type j = i;
+	  while (j != checkpoint_pages.size() && checkpoint_pages[j])
+	    ++j;
+
+	  size_t first = i * MEMORY_PAGE_SIZE;
+	  size_t last = min(j * MEMORY_PAGE_SIZE, _memory_size);
+	  pwrite_or_exit(checkpoint_fildes, contents + first, last - first,
+			 base + first);
+	  i = j;
+	}
+
+      if (fsync(checkpoint_fildes) == -1)
+	_exit(EXIT_FAILURE);
+
+      mark = COMPLETE_MARK;
+      pwrite_or_exit(checkpoint_fildes, &mark, sizeof mark,
+		     COMPLETE_WORD * 4);
+      if (fsync(checkpoint_fildes) == -1)
+	_exit(EXIT_FAILURE);
+
+      _exit(EXIT_SUCCESS);
+    }
+
+  checkpoint_writer = pid;
+
+  unsigned long pause = microseconds() - start;
+  ++_checkpoint_stats.started;
+  _checkpoint_stats.last_pages
+    = count(checkpoint_pages.begin(), checkpoint_pages.end(), true);
+  _checkpoint_stats.last_pause = pause;
+  _checkpoint_stats.max_pause = max(_checkpoint_stats.max_pause, pause);
+
+  if (pause / 10 > _checkpoint_stats.interval * MAX_PAUSE_PERCENT)
+    _checkpoint_stats.interval *= 2;
+}
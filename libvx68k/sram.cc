@@ -95,10 +95,13 @@ sram::~sram()
   munmap(buf, 16 * 1024);
 }
 
-sram::sram()
+sram::sram(const char *file_name)
   : buf(NULL)
 {
-  int fildes = open("sram", O_RDWR | O_CREAT, 0666);
+  int fildes = open(file_name, O_RDWR | O_CREAT, 0666);
+  if (fildes == -1)
+    throw runtime_error(file_name);
+
   off_t off = lseek(fildes, 0, SEEK_END);
   if (off < 16 * 1024)
     {
@@ -108,6 +111,7 @@ sram::sram()
 
   buf = (unsigned char *) mmap(0, 16 * 1024, PROT_READ | PROT_WRITE,
 			       MAP_SHARED, fildes, 0);
+  close(fildes);
 
   unsigned char *ptr = buf + 8;
   if (*uint32_iterator(ptr) == 0)
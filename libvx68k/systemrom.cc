@@ -35,6 +35,7 @@
 
 using vx68k::x68k_address_space;
 using vx68k::system_rom;
+using vx68k::execution_profile;
 using vm68k::context;
 using vm68k::memory;
 using namespace vm68k::types;
@@ -144,9 +145,19 @@ namespace
   using vm68k::byte_size;
   using vm68k::long_word_size;
 
-  /* Handles an IOCS trap.  This function is an instruction handler.  */
+  /* Takes a machine step with context C before an IOCS call.  */
   void
-  iocs_trap(uint16_type, context &c, unsigned long data)
+  step(context &c)
+  {
+    x68k_address_space *as = dynamic_cast<x68k_address_space *>(c.mem);
+    if (as != NULL)
+      as->machine()->step(c);
+  }
+
+  /* Handles an IOCS trap, taking a step before the call to ROM if
+     HOOKED.  */
+  inline void
+  trap_iocs(context &c, unsigned long data, bool hooked)
   {
     sched_yield();
     pthread_testcancel();
@@ -191,22 +202,27 @@ namespace
 	    system_rom *rom = reinterpret_cast<system_rom *>(data);
 	    I(rom != NULL);
 
+	    if (hooked)
+	      step(c);
 	    rom->call_iocs(callno, c);
 	    c.regs.pc += 2;
 	  }
       }
   }
 
-  /* Handles a special IOCS invocation.  This instruction calls a
-     internal IOCS handler and executes a return.  The IOCS call
-     number is derived from the current value of the PC.  */
-  void
-  x68k_iocs(uint16_type, context &c, unsigned long data)
+  /* Handles a special IOCS invocation, taking a step before the call
+     if HOOKED.  This instruction calls a internal IOCS handler and
+     executes a return.  The IOCS call number is derived from the
+     current value of the PC.  */
+  inline void
+  invoke_iocs(context &c, unsigned long data, bool hooked)
   {
     system_rom *rom = reinterpret_cast<system_rom *>(data);
     I(rom != NULL);
 
     int callno = (c.regs.pc - 0xfe0400) / 4;
+    if (hooked)
+      step(c);
     rom->call_iocs(callno, c);
 
     c.regs.pc = long_word_size::get(*c.mem, memory::SUPER_DATA,
@@ -215,6 +231,76 @@ namespace
 			long_word_size::get(c.regs.a[7]
 					    + long_word_size::value_size()));
   }
+
+  /* Handles an IOCS trap.  This function is an instruction handler.  */
+  void
+  iocs_trap(uint16_type, context &c, unsigned long data)
+  {
+    trap_iocs(c, data, false);
+  }
+
+  /* Handles a special IOCS invocation.  */
+  void
+  x68k_iocs(uint16_type, context &c, unsigned long data)
+  {
+    invoke_iocs(c, data, false);
+  }
+
+  /* Handles an IOCS trap in the hooked form.  */
+  void
+  hooked_iocs_trap(uint16_type, context &c, unsigned long data)
+  {
+    system_rom *rom = reinterpret_cast<system_rom *>(data);
+    I(rom != NULL);
+
+    execution_profile *p = rom->profile();
+    if (p == NULL)
+      {
+	trap_iocs(c, data, true);
+	return;
+      }
+
+    execution_profile::scope s(p, execution_profile::IOCS_CALL);
+    p->count_iocs_call(byte_size::get(c.regs.d[0]));
+    trap_iocs(c, data, true);
+  }
+
+  /* Handles a special IOCS invocation in the hooked form.  */
+  void
+  hooked_x68k_iocs(uint16_type, context &c, unsigned long data)
+  {
+    system_rom *rom = reinterpret_cast<system_rom *>(data);
+    I(rom != NULL);
+
+    execution_profile *p = rom->profile();
+    if (p == NULL)
+      {
+	invoke_iocs(c, data, true);
+	return;
+      }
+
+    execution_profile::scope s(p, execution_profile::IOCS_CALL);
+    p->count_iocs_call((c.regs.pc - 0xfe0400) / 4);
+    invoke_iocs(c, data, true);
+  }
+
+  /* Sets the IOCS instructions on EU, in the hooked form if
+     HOOKED.  */
+  void
+  set_iocs_instructions(vm68k::processor *eu, system_rom *rom, bool hooked)
+  {
+    unsigned long data = reinterpret_cast<unsigned long>(rom);
+    if (hooked)
+      {
+	eu->set_instruction(0x4e4f, make_pair(&hooked_iocs_trap, data));
+	eu->set_instruction(0xf84f, make_pair(&hooked_x68k_iocs, data));
+      }
+    else
+      {
+	eu->set_instruction(0x4e4f, make_pair(&iocs_trap, data));
+	eu->set_instruction(0xf84f, make_pair(&x68k_iocs, data));
+      }
+  }
 } // namespace (unnamed)
 
 void
@@ -224,10 +310,21 @@ system_rom::attach(processor *eu)
     throw logic_error("system_rom");
 
   attached_eu = eu;
+  set_iocs_instructions(attached_eu, this, _hooked);
+}
+
+void
+system_rom::set_profile(execution_profile *p)
+{
+  _profile = p;
+}
 
-  unsigned long data = reinterpret_cast<unsigned long>(this);
-  attached_eu->set_instruction(0x4e4f, make_pair(&iocs_trap, data));
-  attached_eu->set_instruction(0xf84f, make_pair(&x68k_iocs, data));
+void
+system_rom::set_hooked(bool hooked)
+{
+  _hooked = hooked;
+  if (attached_eu != NULL)
+    set_iocs_instructions(attached_eu, this, _hooked);
 }
 
 void
@@ -645,7 +742,8 @@ namespace
 #ifdef L
     L("IOCS _DATEGET\n");
 #endif
-    time_t t = time(NULL);
+    x68k_address_space *as = dynamic_cast<x68k_address_space *>(c.mem);
+    time_t t = as->machine()->calendar_time();
     struct tm *lt = localtime(&t);
 
     unsigned int mday = lt->tm_mday;
@@ -714,9 +812,14 @@ namespace
 #ifdef L
     L("IOCS _ONTIME\n");
 #endif
-    fprintf(stderr, "iocs_ontime: FIXME: not implemented\n");
-    long_word_size::put(c.regs.d[0], 0);
-    long_word_size::put(c.regs.d[1], 0);
+    x68k_address_space *as = dynamic_cast<x68k_address_space *>(c.mem);
+
+    // Programs call this in a loop to wait.
+    as->machine()->idle();
+
+    uint32_type t = as->machine()->guest_time();
+    long_word_size::put(c.regs.d[0], t / 10 % (24 * 60 * 60 * 100));
+    long_word_size::put(c.regs.d[1], t / (24 * 60 * 60 * 1000));
   }
 
   /* Handles a _OPMINTST call.  */
@@ -926,7 +1029,8 @@ namespace
 #ifdef L
     L("IOCS _TIMEGET\n");
 #endif
-    time_t t = time(NULL);
+    x68k_address_space *as = dynamic_cast<x68k_address_space *>(c.mem);
+    time_t t = as->machine()->calendar_time();
     struct tm *lt = localtime(&t);
 
     unsigned int sec = lt->tm_sec;
@@ -1112,7 +1216,9 @@ system_rom::~system_rom()
 
 system_rom::system_rom()
   : iocs_calls(0x100, make_pair(&invalid_iocs_call, 0)),
-    attached_eu(NULL)
+    attached_eu(NULL),
+    _profile(NULL),
+    _hooked(false)
 {
   initialize_iocs_calls(this, 0);
 }
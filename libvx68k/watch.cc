@@ -0,0 +1,176 @@
+/* Virtual X68000 - X68000 virtual machine
+   Copyright (C) 1998-2002 Hypercore Software Design, Ltd.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+/* Watchpoints.  Each address space fills a watched page with a
+   watch_memory that forwards to the original memory, so pages without
+   watchpoints are accessed as before.  */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#undef const
+#undef inline
+
+#include <vx68k/machine.h>
+
+#ifdef HAVE_NANA_H
+# include <nana.h>
+#else
+# include <cassert>
+# define I assert
+#endif
+
+using namespace vx68k;
+using namespace std;
+
+int
+watch_memory::get_8(uint32_type address, function_code fc) const
+  throw (memory_exception)
+{
+  int value = _target->get_8(address, fc);
+  _m->watch_access(address, 1, value, fc, false);
+  return value;
+}
+
+uint16_type
+watch_memory::get_16(uint32_type address, function_code fc) const
+  throw (memory_exception)
+{
+  uint16_type value = _target->get_16(address, fc);
+  _m->watch_access(address, 2, value, fc, false);
+  return value;
+}
+
+uint32_type
+watch_memory::get_32(uint32_type address, function_code fc) const
+  throw (memory_exception)
+{
+  uint32_type value = _target->get_32(address, fc);
+  _m->watch_access(address, 4, value, fc, false);
+  return value;
+}
+
+void
+watch_memory::put_8(uint32_type address, int value, function_code fc)
+  throw (memory_exception)
+{
+  _target->put_8(address, value, fc);
+  _m->watch_access(address, 1, value & 0xff, fc, true);
+}
+
+void
+watch_memory::put_16(uint32_type address, uint16_type value,
+		     function_code fc)
+  throw (memory_exception)
+{
+  _target->put_16(address, value, fc);
+  _m->watch_access(address, 2, value, fc, true);
+}
+
+void
+watch_memory::put_32(uint32_type address, uint32_type value,
+		     function_code fc)
+  throw (memory_exception)
+{
+  _target->put_32(address, value, fc);
+  _m->watch_access(address, 4, value, fc, true);
+}
+
+watch_memory::watch_memory(memory *target, class machine *m)
+  : _target(target),
+    _m(m)
+{
+  I(_target != NULL);
+}
+
+void
+x68k_address_space::watch(uint32_type first, uint32_type last)
+{
+  I(last > first);
+  for (uint32_type n = first / DIRECT_PAGE_SIZE;
+       n <= (last - 1) / DIRECT_PAGE_SIZE; ++n)
+    {
+      // Accesses to pages without memory fault anyway.
+      if (page_memories[n] == NULL
+	  || watch_pages.find(n) != watch_pages.end())
+	continue;
+
+      watched_page p = {new watch_memory(page_memories[n], machine()),
+			direct_pages[n]};
+      watch_pages.insert(make_pair(n, p));
+      direct_pages[n] = NULL;
+      fill(n * DIRECT_PAGE_SIZE, (n + 1) * DIRECT_PAGE_SIZE, p.wrapper);
+    }
+}
+
+void
+machine::add_watchpoint(uint32_type first, uint32_type last, int kinds)
+{
+  first &= 0xffffff;
+  if (last > 0x1000000)
+    last = 0x1000000;
+  if (last <= first)
+    return;
+
+  watchpoint w = {first, last, kinds};
+  watchpoints.push_back(w);
+
+  x68k_address_space *as
+    = dynamic_cast<x68k_address_space *>(master_as.get());
+  I(as != NULL);
+  as->watch(first, last);
+}
+
+void
+machine::set_watch_trace(FILE *out, const context *c)
+{
+  watch_trace = out;
+  watched_context = c;
+}
+
+void
+machine::watch_access(uint32_type address, int size, uint32_type value,
+		      memory::function_code fc, bool write) const
+{
+  int kind;
+  if (write)
+    kind = WATCH_WRITE;
+  else if (fc == memory::SUPER_PROGRAM || fc == memory::USER_PROGRAM)
+    kind = WATCH_EXECUTE;
+  else
+    kind = WATCH_READ;
+
+  uint32_type i = address & 0xffffff;
+  for (vector<watchpoint>::const_iterator w = watchpoints.begin();
+       w != watchpoints.end(); ++w)
+    if ((w->kinds & kind) != 0 && i < w->last && i + size > w->first)
+      {
+	if (watch_trace != NULL)
+	  {
+	    watch_record r;
+	    r.pc = watched_context != NULL ? watched_context->regs.pc : 0;
+	    r.address = address;
+	    r.value = value;
+	    r.size = size;
+	    r.function_code = fc;
+	    r.kind = kind;
+	    r.reserved = 0;
+	    fwrite(&r, sizeof r, 1, watch_trace);
+	  }
+	break;
+      }
+}
@@ -32,10 +32,152 @@
 #endif
 
 using namespace vx68k;
+using vm68k::memory_exception;
 using namespace std;
 
+void
+x68k_address_space::map_direct(uint32_type first, uint32_type last,
+			       main_memory *mm)
+{
+  I(first % DIRECT_PAGE_SIZE == 0);
+  I(direct_memory == NULL || direct_memory == mm);
+
+  direct_memory = mm;
+  // A partial page at the end is left to the memory object.
+  for (uint32_type i = first; last - i >= DIRECT_PAGE_SIZE;
+       i += DIRECT_PAGE_SIZE)
+    direct_pages[i / DIRECT_PAGE_SIZE] = mm->contents() + i / 2;
+}
+
+const unsigned short *
+x68k_address_space::direct_span(uint32_type address, uint32_type n) const
+{
+  uint32_type i = address & 0xffffff;
+  if (i % 2 != 0 || n > 0x1000000 - i)
+    return NULL;
+
+  unsigned short *p = direct_pages[i / DIRECT_PAGE_SIZE];
+  if (p == NULL)
+    return NULL;
+
+  // Directly mapped pages are contiguous in main memory, but watched
+  // pages may leave holes.
+  if (n != 0)
+    for (uint32_type k = i / DIRECT_PAGE_SIZE + 1;
+	 k <= (i + n - 1) / DIRECT_PAGE_SIZE; ++k)
+      if (direct_pages[k] == NULL)
+	return NULL;
+
+  return p + i % DIRECT_PAGE_SIZE / 2;
+}
+
+unsigned short *
+x68k_address_space::writable_direct_span(uint32_type address, uint32_type n,
+					 memory::function_code fc)
+{
+  const unsigned short *p = direct_span(address, n);
+  if (p == NULL)
+    return NULL;
+
+  uint32_type i = address & 0xffffff;
+  if (fc != memory::SUPER_DATA && i < direct_memory->super_area_size())
+    return NULL;
+
+  direct_memory->mark_pages(i, n);
+  return const_cast<unsigned short *>(p);
+}
+
+void
+x68k_address_space::set_mapped(uint32_type first, uint32_type last,
+			       memory *m)
+{
+  I(first % DIRECT_PAGE_SIZE == 0);
+  for (uint32_type i = first; i < last; i += DIRECT_PAGE_SIZE)
+    page_memories[i / DIRECT_PAGE_SIZE] = m;
+}
+
+bool
+x68k_address_space::probe_read(uint32_type address, int size,
+			       memory::function_code fc,
+			       uint32_type &value) const
+{
+  I(size == 1 || size == 2 || size == 4);
+  // An odd address for a word is an address error.
+  if ((size != 1 && address % 2 != 0) || !mapped(address)
+      || !mapped(address + size - 1))
+    return false;
+
+  try
+    {
+      switch (size)
+	{
+	case 1:
+	  value = get_8(address, fc);
+	  break;
+
+	case 2:
+	  value = get_16(address, fc);
+	  break;
+
+	default:
+	  value = get_32(address, fc);
+	  break;
+	}
+    }
+  catch (memory_exception &)
+    {
+      return false;
+    }
+
+  return true;
+}
+
+bool
+x68k_address_space::probe_write(uint32_type address, int size,
+				uint32_type value, memory::function_code fc)
+{
+  I(size == 1 || size == 2 || size == 4);
+  if ((size != 1 && address % 2 != 0) || !mapped(address)
+      || !mapped(address + size - 1))
+    return false;
+
+  try
+    {
+      switch (size)
+	{
+	case 1:
+	  put_8(address, value, fc);
+	  break;
+
+	case 2:
+	  put_16(address, value, fc);
+	  break;
+
+	default:
+	  put_32(address, value, fc);
+	  break;
+	}
+    }
+  catch (memory_exception &)
+    {
+      return false;
+    }
+
+  return true;
+}
+
+x68k_address_space::~x68k_address_space()
+{
+  for (map<uint32_type, watched_page>::iterator i = watch_pages.begin();
+       i != watch_pages.end(); ++i)
+    delete i->second.wrapper;
+}
+
 x68k_address_space::x68k_address_space(class machine *m)
-  : _m(m)
+  : _m(m),
+    direct_pages(0x1000000 / DIRECT_PAGE_SIZE),
+    direct_memory(NULL),
+    page_memories(0x1000000 / DIRECT_PAGE_SIZE)
 {
   machine()->configure(*this);
 }
@@ -24,6 +24,8 @@
 
 #include <vx68k/human.h>
 
+#include <stdexcept>
+
 #ifdef HAVE_NANA_H
 # include <nana.h>
 # include <cstdio>
@@ -254,6 +256,29 @@ memory_allocator::alloc_largest(uint32_type parent)
   return long_word_size::svalue(best_candidate + 0x10);
 }
 
+void
+memory_allocator::rescan()
+{
+  if (_as->get_32(root_block + 0, memory::SUPER_DATA) != 0
+      || _as->get_32(root_block + 4, memory::SUPER_DATA) != 0)
+    throw runtime_error("memory_allocator: no memory chain at the root");
+
+  // Blocks are chained in ascending order of addresses.
+  uint32_type block = root_block;
+  for (;;)
+    {
+      uint32_type next = _as->get_32(block + 12, memory::SUPER_DATA);
+      if (next == 0)
+	break;
+      if (next <= block || next + 0x10 > limit
+	  || _as->get_32(next + 0, memory::SUPER_DATA) != block)
+	throw runtime_error("memory_allocator: broken memory chain");
+      block = next;
+    }
+
+  last_block = block;
+}
+
 memory_allocator::memory_allocator(memory_map *as,
 				   uint32_type address, uint32_type lim)
   : _as(as),
@@ -41,6 +41,44 @@ using namespace std;
 
 namespace
 {
+  /* Writes N bytes at DATA and a NUL to ADDRESS of AS.  */
+  void
+  put_bytes(memory_map &as, uint32_type address, const char *data, size_t n)
+  {
+    vx68k::write_block(as, address, data, n, memory::SUPER_DATA);
+    as.put_8(address + n, 0, memory::SUPER_DATA);
+  }
+
+  void
+  dos_bus_err(uint16_type op, context &c, unsigned long data)
+  {
+    uint32_type sp = c.regs.a[7];
+    uint32_type src = c.mem->get_32(sp + 0, memory::SUPER_DATA);
+    uint32_type dest = c.mem->get_32(sp + 4, memory::SUPER_DATA);
+    int size = c.mem->get_16(sp + 8, memory::SUPER_DATA);
+#ifdef L
+    L(" DOS _BUS_ERR\n");
+#endif
+
+    vx68k::x68k_address_space *as
+      = dynamic_cast<vx68k::x68k_address_space *>(c.mem);
+    I(as != NULL);
+
+    // Programs call this to probe for devices, so faults are reported
+    // without exceptions wherever possible.
+    uint32_type value;
+    if (size != 1 && size != 2 && size != 4)
+      c.regs.d[0] = uint32_type(-1);
+    else if (!as->probe_read(src, size, memory::SUPER_DATA, value))
+      c.regs.d[0] = 2;
+    else if (!as->probe_write(dest, size, value, memory::SUPER_DATA))
+      c.regs.d[0] = 1;
+    else
+      c.regs.d[0] = 0;
+
+    c.regs.pc += 2;
+  }
+
   void
   dos_chmod(uint16_type op, context &c, unsigned long data)
   {
@@ -51,9 +89,7 @@ namespace
     L(" DOS _CHMOD\n");
 #endif
 
-    dos *d = reinterpret_cast<dos *>(data);
-    I(d != NULL);
-    c.regs.d[0] = d->fs()->chmod(c.mem, nameptr, atr);
+    c.regs.d[0] = static_cast<dos_exec_context &>(c).chmod(nameptr, atr);
 
     c.regs.pc += 2;
   }
@@ -133,8 +169,6 @@ namespace
     L(" DOS _FFLUSH\n");
 #endif
 
-    dos *d = reinterpret_cast<dos *>(data);
-    I(d != NULL);
     // FIXME
 
     c.regs.pc += 2;
@@ -205,7 +239,9 @@ namespace
     L(" DOS _GETDATE\n");
 #endif
 
-    time_t t = time(NULL);
+    vx68k::x68k_address_space *as
+      = dynamic_cast<vx68k::x68k_address_space *>(c.mem);
+    time_t t = as->machine()->calendar_time();
 #ifdef HAVE_LOCALTIME_R
     struct tm lt0;
     struct tm *lt = localtime_r(&t, &lt0);
@@ -257,7 +293,9 @@ namespace
     L(" DOS _GETTIM2\n");
 #endif
 
-    time_t t = time(NULL);
+    vx68k::x68k_address_space *as
+      = dynamic_cast<vx68k::x68k_address_space *>(c.mem);
+    time_t t = as->machine()->calendar_time();
 #ifdef HAVE_LOCALTIME_R
     struct tm lt0;
     struct tm *lt = localtime_r(&t, &lt0);
@@ -322,23 +360,18 @@ namespace
     L(" DOS _NAMECK\n");
 #endif
 
-    dos *d = reinterpret_cast<dos *>(data);
-    I(d != NULL);
-
     // FIXME
-    string buf = c.mem->get_string(file, memory::SUPER_DATA);
-    string::size_type p = buf.find_last_of(buf, '/');
-    if (p == string::npos)
-      {
-	c.mem->put_string(buffer + 0, "./", memory::SUPER_DATA);
-	c.mem->put_string(buffer + 67, buf, memory::SUPER_DATA);
-      }
+    vx68k::guest_string buf(*c.mem, file, memory::SUPER_DATA);
+    const char *begin = buf.data();
+    const char *end = buf.data() + buf.size();
+    const char *p = end;
+    while (p != begin && p[-1] != '/' && p[-1] != '\\')
+      --p;
+    if (p == begin)
+      put_bytes(*c.mem, buffer + 0, "./", 2);
     else
-      {
-	++p;
-	c.mem->put_string(buffer + 0, buf.substr(0, p), memory::SUPER_DATA);
-	c.mem->put_string(buffer + 67, buf.substr(p), memory::SUPER_DATA);
-      }
+      put_bytes(*c.mem, buffer + 0, begin, p - begin);
+    put_bytes(*c.mem, buffer + 67, p, end - p);
     c.regs.d[0] = 0;
 
     c.regs.pc += 2;
@@ -543,47 +576,92 @@ namespace
     c.regs.pc += 2;
   }
 
-  /* Adds DOS-call instructions to processor EU.  */
-  void
-  add_instructions(processor &eu, dos *d)
-  {
-    unsigned long data = reinterpret_cast<unsigned long>(d);
-    eu.set_instruction(0xff02u, make_pair(&dos_putchar, data));
-    eu.set_instruction(0xff08u, make_pair(&dos_getc, data));
-    eu.set_instruction(0xff09u, make_pair(&dos_print, data));
-    eu.set_instruction(0xff0du, make_pair(&dos_fflush, data));
-    eu.set_instruction(0xff1bu, make_pair(&dos_fgetc, data));
-    eu.set_instruction(0xff1eu, make_pair(&dos_fputs, data));
-    eu.set_instruction(0xff20u, make_pair(&dos_super, data));
-    eu.set_instruction(0xff25u, make_pair(&dos_intvcs, data));
-    eu.set_instruction(0xff27u, make_pair(&dos_gettim2, data));
-    eu.set_instruction(0xff2au, make_pair(&dos_getdate, data));
-    eu.set_instruction(0xff30u, make_pair(&dos_vernum, data));
-    eu.set_instruction(0xff37u, make_pair(&dos_nameck, data));
-    eu.set_instruction(0xff3cu, make_pair(&dos_create, data));
-    eu.set_instruction(0xff3du, make_pair(&dos_open, data));
-    eu.set_instruction(0xff3eu, make_pair(&dos_close, data));
-    eu.set_instruction(0xff3fu, make_pair(&dos_read, data));
-    eu.set_instruction(0xff40u, make_pair(&dos_write, data));
-    eu.set_instruction(0xff41u, make_pair(&dos_delete, data));
-    eu.set_instruction(0xff42u, make_pair(&dos_seek, data));
-    eu.set_instruction(0xff43u, make_pair(&dos_chmod, data));
-    eu.set_instruction(0xff44u, make_pair(&dos_ioctrl, data));
-    eu.set_instruction(0xff45u, make_pair(&dos_dup, data));
-    eu.set_instruction(0xff48u, make_pair(&dos_malloc, data));
-    eu.set_instruction(0xff4au, make_pair(&dos_setblock, data));
-    eu.set_instruction(0xff4cu, make_pair(&dos_exit2, data));
-    eu.set_instruction(0xff51u, make_pair(&dos_getpdb, data));
-    eu.set_instruction(0xff53u, make_pair(&dos_getenv, data));
-    eu.set_instruction(0xff57u, make_pair(&dos_filedate, data));
-    eu.set_instruction(0xfff6u, make_pair(&dos_super_jsr, data));
-
-    eu.set_instruction(0xff81u, make_pair(&dos_getpdb, data));
-    eu.set_instruction(0xff83u, make_pair(&dos_getenv, data));
-    eu.set_instruction(0xff87u, make_pair(&dos_filedate, data));
+  typedef void (*dos_call_handler)(uint16_type, context &, unsigned long);
+
+  /* Table of the DOS-call instructions.  */
+  const struct
+  {
+    uint16_type op;
+    dos_call_handler handler;
+  } dos_calls[] = {
+    {0xff02u, &dos_putchar},
+    {0xff08u, &dos_getc},
+    {0xff09u, &dos_print},
+    {0xff0du, &dos_fflush},
+    {0xff1bu, &dos_fgetc},
+    {0xff1eu, &dos_fputs},
+    {0xff20u, &dos_super},
+    {0xff25u, &dos_intvcs},
+    {0xff27u, &dos_gettim2},
+    {0xff2au, &dos_getdate},
+    {0xff30u, &dos_vernum},
+    {0xff37u, &dos_nameck},
+    {0xff3cu, &dos_create},
+    {0xff3du, &dos_open},
+    {0xff3eu, &dos_close},
+    {0xff3fu, &dos_read},
+    {0xff40u, &dos_write},
+    {0xff41u, &dos_delete},
+    {0xff42u, &dos_seek},
+    {0xff43u, &dos_chmod},
+    {0xff44u, &dos_ioctrl},
+    {0xff45u, &dos_dup},
+    {0xff48u, &dos_malloc},
+    {0xff4au, &dos_setblock},
+    {0xff4cu, &dos_exit2},
+    {0xff51u, &dos_getpdb},
+    {0xff53u, &dos_getenv},
+    {0xff57u, &dos_filedate},
+    {0xfff6u, &dos_super_jsr},
+    {0xfff7u, &dos_bus_err},
+
+    {0xff81u, &dos_getpdb},
+    {0xff83u, &dos_getenv},
+    {0xff87u, &dos_filedate},
+  };
+
+  const size_t NDOS_CALLS = sizeof dos_calls / sizeof dos_calls[0];
+
+  /* Handles a DOS-call instruction in the hooked form.  DATA is the
+     index of the call in dos_calls.  The machine takes a step before
+     the call, and the call is counted if profiling.  */
+  void
+  hooked_dos_call(uint16_type op, context &c, unsigned long data)
+  {
+    I(data < NDOS_CALLS);
+    dos_call_handler handler = dos_calls[data].handler;
+
+    vx68k::x68k_address_space *as
+      = dynamic_cast<vx68k::x68k_address_space *>(c.mem);
+    I(as != NULL);
+    as->machine()->step(c);
+
+    vx68k::execution_profile *p = as->machine()->profile();
+    if (p == NULL)
+      {
+	(*handler)(op, c, data);
+	return;
+      }
+
+    vx68k::execution_profile::scope s(p, vx68k::execution_profile::DOS_CALL);
+    p->count_dos_call(op);
+    (*handler)(op, c, data);
   }
 } // (unnamed namespace)
 
+void
+dos::set_instructions(processor &eu, bool hooked)
+{
+  for (size_t i = 0; i != NDOS_CALLS; ++i)
+    {
+      dos_call_handler handler = dos_calls[i].handler;
+      if (hooked)
+	handler = &hooked_dos_call;
+      unsigned long data = i;
+      eu.set_instruction(dos_calls[i].op, make_pair(handler, data));
+    }
+}
+
 dos_exec_context *
 dos::create_context()
 {
@@ -594,13 +672,24 @@ dos::create_context()
   return c;
 }
 
+void
+dos::set_profile(vx68k::execution_profile *p)
+{
+  as.machine()->set_profile(p);
+}
+
+dos::~dos()
+{
+  as.machine()->remove_hooked_instructions(this);
+}
+
 dos::dos(class machine *m)
   : as(m),
     allocator(&as, 0x8000u, as.machine()->memory_size()),
     _fs(as.machine()),
     debug_level(0)
 {
-  add_instructions(*as.machine()->processor(), this);
+  as.machine()->add_hooked_instructions(this);
 
   // Dummy NUL device.  LHA scans this for TwentyOne?
   as.put_32(0x6900 +  0, 0x6a00, memory::SUPER_DATA);
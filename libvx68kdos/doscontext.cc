@@ -28,6 +28,7 @@
 #include <algorithm>
 #include <stdexcept>
 #include <cstdlib>
+#include <cstring>
 #include <cstdio>
 
 #ifdef HAVE_NANA_H
@@ -135,6 +136,13 @@ dos_exec_context::open(uint32_type nameptr, uint16_type mode)
   return err < 0 ? err : found - (files + 0);
 }
 
+/* Changes or gets the attributes of a file.  */
+sint16_type
+dos_exec_context::chmod(uint32_type nameptr, sint16_type atr)
+{
+  return _fs->chmod(mem, nameptr, atr);
+}
+
 /* Creates a file.  */
 sint16_type
 dos_exec_context::create(uint32_type nameptr, uint16_type atr)
@@ -253,7 +261,8 @@ dos_exec_context::load_executable(const char *name, uint32_type address)
       is.read (buf, text_size + data_size);
       if (!is)
 	throw runtime_error("read error");
-      mem->write(load_address, buf, text_size + data_size, memory::SUPER_DATA);
+      vx68k::write_block(*mem, load_address, buf, text_size + data_size,
+			 memory::SUPER_DATA);
     }
   catch (...)
     {
@@ -334,17 +343,16 @@ sint16_type
 dos_exec_context::getenv(uint32_type getname, uint32_type env,
 			 uint32_type getbuf)
 {
-  string name = mem->get_string(getname, memory::SUPER_DATA);
+  vx68k::guest_string name(*mem, getname, memory::SUPER_DATA);
 
   // FIXME
-  string s;
   const char *value = ::getenv(name.c_str());
-  if (value != NULL)
-    s = value;
+  if (value == NULL)
+    value = "";
 
-  if (s.size() > 255)
-    s.erase(255);
-  mem->put_string(getbuf, s, memory::SUPER_DATA);
+  size_t n = min(strlen(value), size_t(255));
+  vx68k::write_block(*mem, getbuf, value, n, memory::SUPER_DATA);
+  mem->put_8(getbuf + n, 0, memory::SUPER_DATA);
 
   return 0;
 }
@@ -25,12 +25,14 @@
 #include <vx68k/human.h>
 
 #include <sys/stat.h>
+#include <sys/uio.h>
 #ifdef HAVE_FCNTL_H
 # include <fcntl.h>
 #endif
 #ifdef HAVE_UNISTD_H
 # include <unistd.h>
 #endif
+#include <algorithm>
 #include <cstring>
 #include <cerrno>
 
@@ -48,24 +50,153 @@ using namespace std;
 
 namespace
 {
+  /* Size of the buffer file data is copied through when it cannot be
+     used in place.  */
+  const uint32_type BOUNCE_SIZE = 16 * 1024;
+
+  /* Reads up to N bytes from FILDES to ADDRESS of AS through a
+     bounded buffer, stopping at the first short read.  Returns the
+     number of bytes read, or -1 if nothing could be read.  */
+  ssize_t
+  read_into(int fildes, memory_map &as, uint32_type address, uint32_type n)
+  {
+    unsigned char buf[BOUNCE_SIZE];
+    uint32_type done = 0;
+    while (done != n)
+      {
+	uint32_type k = min(n - done, BOUNCE_SIZE);
+	ssize_t result = ::read(fildes, buf, k);
+	if (result == -1)
+	  return done != 0 ? ssize_t(done) : -1;
+
+	write_block(as, address + done, buf, result, memory::SUPER_DATA);
+	done += result;
+	if (uint32_type(result) != k)
+	  break;
+      }
+
+    return done;
+  }
+
+  /* Writes N bytes at ADDRESS of AS to FILDES through a bounded
+     buffer, so that guest memory is never changed.  Returns the
+     number of bytes written, or -1 if nothing could be written.  */
+  ssize_t
+  write_from(int fildes, const memory_map &as, uint32_type address,
+	     uint32_type n)
+  {
+    unsigned char buf[BOUNCE_SIZE];
+    uint32_type done = 0;
+    while (done != n)
+      {
+	uint32_type k = min(n - done, BOUNCE_SIZE);
+	read_block(as, address + done, buf, k, memory::SUPER_DATA);
+	ssize_t result = ::write(fildes, buf, k);
+	if (result == -1)
+	  return done != 0 ? ssize_t(done) : -1;
+
+	done += result;
+	if (uint32_type(result) != k)
+	  break;
+      }
+
+    return done;
+  }
+
+  /* Splits N bytes at ADDRESS into a leading odd byte, whole words and
+     a trailing odd byte.  */
+  inline void
+  split_range(uint32_type address, uint32_type n,
+	      uint32_type &lead, uint32_type &words, uint32_type &trail)
+  {
+    lead = min(address % 2, n);
+    words = (n - lead) / 2 * 2;
+    trail = n - lead - words;
+  }
+
+  /* Appends to NAME the host file name for the N bytes of DOS_NAME.
+     Spaces padding each component are removed.  */
+  void
+  export_name(const char *dos_name, size_t n, string &name)
+  {
+    // FIXME.  Kanji must be handled.
+    static const char separators[] = ".\\/";
+
+    const char *end = dos_name + n;
+    const char *p = dos_name;
+    while (p != end && *p == ' ')
+      ++p;
+
+    if (p != end && *p == '\\')
+      {
+	name.append(1, '/');
+	++p;
+      }
+
+    for (;;)
+      {
+	const char *next = find_first_of(p, end, separators + 0,
+					 separators + 3);
+	if (next != end && *next == '/')
+	  {
+	    name.append(p, next + 1);
+	    p = next + 1;
+	    continue;
+	  }
+
+	const char *q = next;
+	while (q != p && q[-1] == ' ')
+	  --q;
+	name.append(p, q);
+	if (next == end)
+	  break;
+
+	name.append(1, *next == '\\' ? '/' : *next);
+	p = next + 1;
+      }
+  }
 } // (unnamed namespace)
 
 sint32_type
 regular_file::read(memory_map *as,
 		   uint32_type dataptr, uint32_type size)
 {
-  // FIXME.
-  unsigned char *data = new unsigned char [size];
-
-  ssize_t result = ::read(fd, data, size);
-  if (result == -1)
+#ifdef MAIN_MEMORY_GUEST_ORDER
+  // Main memory is read into in place, where a short read leaves the
+  // bytes after the last one read unchanged.  In the other layout a
+  // short read ending inside a word would overwrite the other byte of
+  // that word, so the data goes through a buffer.
+  x68k_address_space *xas = dynamic_cast<x68k_address_space *>(as);
+  if (xas != NULL)
     {
-      delete [] data;
-      return -6;			// FIXME.
+      uint32_type lead, words, trail;
+      split_range(dataptr, size, lead, words, trail);
+      unsigned short *span
+	= xas->writable_direct_span(dataptr + lead, words, memory::SUPER_DATA);
+      if (span != NULL)
+	{
+	  unsigned char lead_byte, trail_byte;
+	  struct iovec iov[3]
+	    = {{&lead_byte, lead}, {span, words}, {&trail_byte, trail}};
+	  ssize_t result = readv(fd, iov, 3);
+	  if (result == -1)
+	    return -6;			// FIXME.
+
+	  uint32_type n = result;
+	  if (n != 0 && lead != 0)
+	    as->put_8(dataptr, lead_byte, memory::SUPER_DATA);
+	  if (n == size && trail != 0)
+	    as->put_8(dataptr + lead + words, trail_byte, memory::SUPER_DATA);
+
+	  return n;
+	}
     }
+#endif
+
+  ssize_t result = read_into(fd, *as, dataptr, size);
+  if (result == -1)
+    return -6;			// FIXME.
 
-  as->write(dataptr, data, result, memory::SUPER_DATA);
-  delete [] data;
   return result;
 }
 
@@ -73,18 +204,44 @@ sint32_type
 regular_file::write(const memory_map *as, uint32_type dataptr,
 		    uint32_type size)
 {
-  // FIXME.
-  unsigned char *data = new unsigned char [size];
-  as->read(dataptr, data, size, memory::SUPER_DATA);
-
-  ssize_t result = ::write(fd, data, size);
-  if (result == -1)
+#ifdef MAIN_MEMORY_GUEST_ORDER
+  // Main memory is written from in place.  In the other layout it
+  // goes through a buffer, as main memory may be mapped from a file or
+  // shared copy-on-write with forked processes and must not be
+  // swapped even for a moment.
+  const x68k_address_space *xas
+    = dynamic_cast<const x68k_address_space *>(as);
+  if (xas != NULL)
     {
-      delete [] data;
-      return -6;			// FIXME.
+      uint32_type lead, words, trail;
+      split_range(dataptr, size, lead, words, trail);
+      const unsigned short *span = xas->direct_span(dataptr + lead, words);
+      if (span != NULL)
+	{
+	  unsigned char lead_byte = 0, trail_byte = 0;
+	  if (lead != 0)
+	    lead_byte = as->get_8(dataptr, memory::SUPER_DATA);
+	  if (trail != 0)
+	    trail_byte = as->get_8(dataptr + lead + words,
+				   memory::SUPER_DATA);
+
+	  struct iovec iov[3]
+	    = {{&lead_byte, lead},
+	       {const_cast<unsigned short *>(span), words},
+	       {&trail_byte, trail}};
+	  ssize_t result = writev(fd, iov, 3);
+	  if (result == -1)
+	    return -6;			// FIXME.
+
+	  return result;
+	}
     }
+#endif
+
+  ssize_t result = write_from(fd, *as, dataptr, size);
+  if (result == -1)
+    return -6;			// FIXME.
 
-  delete [] data;
   return result;
 }
 
@@ -105,7 +262,8 @@ regular_file::fputc(sint16_type code)
   // FIXME.
   unsigned char data[1];
   data[0] = code;
-  ::write(fd, data, 1);
+  if (::write(fd, data, 1) == -1)
+    return -6;			// FIXME.
 
   return 1;
 }
@@ -113,7 +271,7 @@ regular_file::fputc(sint16_type code)
 sint32_type
 regular_file::fputs(const memory_map *as, uint32_type mesptr)
 {
-  string mes = as->get_string(mesptr, memory::SUPER_DATA);
+  guest_string mes(*as, mesptr, memory::SUPER_DATA);
 
   ssize_t written_size = ::write(fd, mes.data(), mes.size());
   if (written_size == -1)
@@ -220,59 +378,84 @@ con_device_file::con_device_file(machine *m)
   : _m(m)
 {
 }
-
-string
-file_system::export_file_name(const string &dos_name)
+
+namespace
 {
-  // FIXME.  Kanji must be handled.
-  string name;
-  string::size_type pos = dos_name.find_first_not_of(' ');
+  /* CON connected to the host standard input and output.  */
+  class host_console_file
+    : public file
+  {
+  public:
+    sint32_type read(memory_map *, uint32_type, uint32_type);
+    sint32_type write(const memory_map *, uint32_type, uint32_type);
+    sint16_type fgetc();
+    sint16_type fputc(sint16_type);
+    sint32_type fputs(const memory_map *, uint32_type);
+  };
+} // (unnamed namespace)
 
-  if (pos != string::npos && dos_name.at(pos) == '\\')
-    {
-      name.append(1, '/');
-      ++pos;
-    }
+sint32_type
+host_console_file::read(memory_map *as, uint32_type dataptr, uint32_type size)
+{
+  ssize_t result = read_into(STDIN_FILENO, *as, dataptr, size);
+  if (result == -1)
+    return -6;			// FIXME.
 
-  for (;;)
-    {
-      if (pos == string::npos || pos == dos_name.size())
-	break;
+  return result;
+}
 
-      string::size_type next_pos = dos_name.find_first_of(".\\/", pos);
-      if (next_pos == string::npos)
-	break;
+sint32_type
+host_console_file::write(const memory_map *as,
+			 uint32_type dataptr, uint32_type size)
+{
+  ssize_t result = write_from(STDOUT_FILENO, *as, dataptr, size);
+  if (result == -1)
+    return -6;			// FIXME.
 
-      if (dos_name.at(next_pos) == '/')
-	name.append(dos_name.substr(pos, next_pos + 1 - pos));
-      else
-	{
-	  string::size_type end = next_pos - 1;
-	  if (next_pos != pos)
-	    {
-	      end = dos_name.find_last_not_of(' ', end);
-	      if (end == string::npos || end < pos - 1)
-		end = next_pos - 1;
-	    }
-	  name.append(dos_name.substr(pos, end + 1 - pos));
-	  char c = dos_name.at(next_pos);
-	  if (c == '\\')
-	    c = '/';
-	  name.append(1, c);
-	}
+  return result;
+}
 
-      pos = next_pos + 1;
-    }
+sint16_type
+host_console_file::fgetc()
+{
+  unsigned char data[1];
+  ssize_t result = ::read(STDIN_FILENO, data, 1);
+  if (result == -1)
+    return -6;			// FIXME.
+  if (result == 0)
+    return 0x1a;		// EOF
 
-  string::size_type end = dos_name.size() - 1;
-  if (dos_name.size() != pos)
-    {
-      end = dos_name.find_last_not_of(' ');
-      if (end == string::npos || end < pos - 1)
-	end = dos_name.size() - 1;
-    }
-  name.append(dos_name.substr(pos, end + 1 - pos));
+  return data[0];
+}
 
+sint16_type
+host_console_file::fputc(sint16_type code)
+{
+  unsigned char data[1];
+  data[0] = code;
+  if (::write(STDOUT_FILENO, data, 1) == -1)
+    return -6;			// FIXME.
+
+  return 1;
+}
+
+sint32_type
+host_console_file::fputs(const memory_map *as, uint32_type mesptr)
+{
+  guest_string mes(*as, mesptr, memory::SUPER_DATA);
+
+  ssize_t written_size = ::write(STDOUT_FILENO, mes.data(), mes.size());
+  if (written_size == -1)
+    return -6;			// FIXME
+
+  return written_size;
+}
+
+string
+file_system::export_file_name(const string &dos_name)
+{
+  string name;
+  export_name(dos_name.data(), dos_name.size(), name);
   return name;
 }
 
@@ -324,7 +507,11 @@ file_system::open(file *&ret, const string &name, uint16_type mode)
 
   if (strcasecmp(name.c_str(), "con") == 0) // FIXME
     {
-      con_device_file *f = new con_device_file(_m);
+      file *f;
+      if (_host_console)
+	f = new host_console_file;
+      else
+	f = new con_device_file(_m);
       files.insert(make_pair(f, 1));
       ret = f;
     }
@@ -362,16 +549,18 @@ file_system::open(file *&ret, const memory_map *as,
 		  uint32_type nameptr,
 		  sint16_type mode)
 {
-  string name = as->get_string(nameptr, memory::SUPER_DATA);
+  guest_string name(*as, nameptr, memory::SUPER_DATA);
 
-  return open(ret, name, mode);
+  return open(ret, name.str(), mode);
 }
 
 sint16_type
 file_system::create(file *&ret, const memory_map *as,
 		    uint32_type nameptr, sint16_type atr)
 {
-  string name = export_file_name(as->get_string(nameptr, memory::SUPER_DATA));
+  guest_string dos_name(*as, nameptr, memory::SUPER_DATA);
+  string name;
+  export_name(dos_name.data(), dos_name.size(), name);
 
   // FIXME.
   int fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
@@ -394,7 +583,9 @@ sint16_type
 file_system::chmod(const memory_map *as,
 		   uint32_type nameptr, sint16_type atr)
 {
-  string name = export_file_name(as->get_string(nameptr, memory::SUPER_DATA));
+  guest_string dos_name(*as, nameptr, memory::SUPER_DATA);
+  string name;
+  export_name(dos_name.data(), dos_name.size(), name);
 
   struct stat stbuf;
   if (stat(name.c_str(), &stbuf) == -1)
@@ -426,7 +617,8 @@ file_system::chmod(const memory_map *as,
 }
 
 file_system::file_system(machine *m)
-  : _m(m)
+  : _m(m),
+    _host_console(false)
 {
 }
 
@@ -0,0 +1,842 @@
+/* Virtual X68000 - X68000 virtual machine
+   Copyright (C) 1998-2002 Hypercore Software Design, Ltd.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.  */
+
+/* vx68k-run runs one X68000 command without any user interface.  CON
+   is connected to the standard input and output of this process, and
+   the exit code of the command becomes the exit status.  */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#undef const
+#undef inline
+
+#include "getopt.h"
+
+#include <vx68k/human.h>
+#include <vx68k/version.h>
+
+#include <libintl.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include <exception>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+
+#define _(MSG) gettext(MSG)
+
+extern char **environ;
+
+using namespace vx68k;
+using namespace std;
+
+#define COPYRIGHT_YEAR "1998-2002"
+
+namespace
+{
+  /* Console without a display.  Character images are blank, so text
+     written directly to the text VRAM is not visible anywhere.  */
+  class batch_console: public virtual console
+  {
+  public:
+    time_type current_time() const;
+    void get_b16_image(unsigned int, unsigned char *, size_t) const;
+    void get_k16_image(unsigned int, unsigned char *, size_t) const;
+  };
+
+  console::time_type
+  batch_console::current_time() const
+  {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  }
+
+  void
+  batch_console::get_b16_image(unsigned int c,
+			       unsigned char *buf, size_t row_size) const
+  {
+    for (int i = 0; i != 16; ++i)
+      buf[i * row_size] = 0;
+  }
+
+  void
+  batch_console::get_k16_image(unsigned int c,
+			       unsigned char *buf, size_t row_size) const
+  {
+    for (int i = 0; i != 16; ++i)
+      {
+	buf[i * row_size + 0] = 0;
+	buf[i * row_size + 1] = 0;
+      }
+  }
+
+  /* Thread that checks the machine timers every 10 ms, as the GTK+
+     console does.  The thread is stopped on destruction.  */
+  class timer_thread
+  {
+  private:
+    machine *_m;
+    const console *_con;
+    pthread_t thread;
+
+  protected:
+    static void *run(void *) throw ();
+
+  public:
+    timer_thread(machine *m, const console *con);
+    ~timer_thread();
+  };
+
+  void *
+  timer_thread::run(void *data) throw ()
+  {
+    timer_thread *t = static_cast<timer_thread *>(data);
+    for (;;)
+      {
+	t->_m->check_timers(t->_con->current_time());
+	usleep(10 * 1000);
+      }
+
+    return NULL;
+  }
+
+  timer_thread::~timer_thread()
+  {
+    pthread_cancel(thread);
+    pthread_join(thread, NULL);
+  }
+
+  timer_thread::timer_thread(machine *m, const console *con)
+    : _m(m), _con(con)
+  {
+    pthread_create(&thread, NULL, &run, this);
+  }
+
+  const size_t MEMSIZE = 4 * 1024 * 1024;
+
+  /* Size of main memory.  */
+  size_t opt_memory_size = MEMSIZE;
+
+  /* File name of the SRAM.  */
+  const char *opt_sram_file = "sram";
+
+  /* File to keep the main memory contents in, or null.  */
+  const char *opt_memory_file = NULL;
+
+  /* Speed of the guest clock, or zero for as fast as possible.  */
+  unsigned int opt_speed = 1;
+
+  /* Snapshot files to restore before and save after the command, or
+     null.  */
+  const char *opt_load_state = NULL;
+  const char *opt_save_state = NULL;
+
+  /* Checkpoint file, or null.  */
+  const char *opt_checkpoint = NULL;
+
+  /* Interval between checkpoints in seconds.  */
+  unsigned int opt_checkpoint_interval = 60;
+
+  /* Files to record external events to or replay them from, or
+     null.  */
+  const char *opt_record_events = NULL;
+  const char *opt_replay_events = NULL;
+
+  /* File of commands to run each in a forked clone of the machine,
+     or null.  */
+  const char *opt_jobs = NULL;
+
+  /* Maximum number of jobs to run at a time.  */
+  unsigned int opt_max_jobs = 1;
+
+  /* Watchpoint given as an option.  */
+  struct watch_option
+  {
+    uint32_type first, last;
+    int kinds;
+  };
+
+  /* Watchpoints, and the file to trace their hits to or null.  */
+  vector<watch_option> opt_watches;
+  const char *opt_watch_trace = NULL;
+
+  /* Parses ARG as `FIRST-LAST[:KINDS]' into W.  KINDS is a
+     combination of `r', `w' and `x', and defaults to `w'.  */
+  bool
+  parse_watch(const char *arg, watch_option &w)
+  {
+    char *end;
+    w.first = strtoul(arg, &end, 0);
+    if (end == arg || *end != '-')
+      return false;
+    arg = end + 1;
+    w.last = strtoul(arg, &end, 0);
+    if (end == arg || w.last <= w.first)
+      return false;
+
+    if (*end == '\0')
+      {
+	w.kinds = machine::WATCH_WRITE;
+	return true;
+      }
+    if (*end != ':' || end[1] == '\0')
+      return false;
+
+    w.kinds = 0;
+    for (const char *i = end + 1; *i != '\0'; ++i)
+      switch (*i)
+	{
+	case 'r':
+	  w.kinds |= machine::WATCH_READ;
+	  break;
+
+	case 'w':
+	  w.kinds |= machine::WATCH_WRITE;
+	  break;
+
+	case 'x':
+	  w.kinds |= machine::WATCH_EXECUTE;
+	  break;
+
+	default:
+	  return false;
+	}
+
+    return true;
+  }
+
+  int opt_debug_level = 0;
+  int opt_help = false;
+  int opt_version = false;
+
+  bool
+  parse_options(int argc, char **argv)
+  {
+    static const struct option longopts[]
+      = {{"memory-size", required_argument, NULL, 'm'},
+	 {"sram-file", required_argument, NULL, 's'},
+	 {"memory-file", required_argument, NULL, 'M'},
+	 {"speed", required_argument, NULL, 'S'},
+	 {"load-state", required_argument, NULL, 'L'},
+	 {"save-state", required_argument, NULL, 'W'},
+	 {"checkpoint", required_argument, NULL, 'C'},
+	 {"checkpoint-interval", required_argument, NULL, 'I'},
+	 {"record-events", required_argument, NULL, 'R'},
+	 {"replay-events", required_argument, NULL, 'Y'},
+	 {"jobs", required_argument, NULL, 'J'},
+	 {"max-jobs", required_argument, NULL, 'P'},
+	 {"watch", required_argument, NULL, 'w'},
+	 {"watch-trace", required_argument, NULL, 'T'},
+	 {"debug", no_argument, &opt_debug_level, 1},
+	 {"help", no_argument, &opt_help, true},
+	 {"version", no_argument, &opt_version, true},
+	 {NULL, 0, NULL, 0}};
+
+    for (;;)
+      {
+	int index;
+	// `+' stops at the command so that its options are left alone.
+	int opt = getopt_long(argc, argv, "+m:s:", longopts, &index);
+	if (opt == -1)		// no more options
+	  break;
+
+	switch (opt)
+	  {
+	  case 'm':
+	    {
+	      int mega = atoi(optarg);
+	      if (mega < 1 || mega > 12)
+		{
+		  fprintf(stderr, _("%s: invalid memory size `%s'\n"),
+			  argv[0], optarg);
+		  return false;
+		}
+
+	      opt_memory_size = mega * 1024 * 1024;
+	    }
+	    break;
+
+	  case 's':
+	    opt_sram_file = optarg;
+	    break;
+
+	  case 'M':
+	    opt_memory_file = optarg;
+	    break;
+
+	  case 'S':
+	    if (strcmp(optarg, "max") == 0)
+	      opt_speed = 0;
+	    else
+	      {
+		int n = atoi(optarg);
+		if (n < 1)
+		  {
+		    fprintf(stderr, _("%s: invalid speed `%s'\n"),
+			    argv[0], optarg);
+		    return false;
+		  }
+
+		opt_speed = n;
+	      }
+	    break;
+
+	  case 'L':
+	    opt_load_state = optarg;
+	    break;
+
+	  case 'W':
+	    opt_save_state = optarg;
+	    break;
+
+	  case 'C':
+	    opt_checkpoint = optarg;
+	    break;
+
+	  case 'I':
+	    {
+	      int n = atoi(optarg);
+	      if (n < 1)
+		{
+		  fprintf(stderr, _("%s: invalid checkpoint interval `%s'\n"),
+			  argv[0], optarg);
+		  return false;
+		}
+
+	      opt_checkpoint_interval = n;
+	    }
+	    break;
+
+	  case 'R':
+	    opt_record_events = optarg;
+	    break;
+
+	  case 'Y':
+	    opt_replay_events = optarg;
+	    break;
+
+	  case 'J':
+	    opt_jobs = optarg;
+	    break;
+
+	  case 'P':
+	    {
+	      int n = atoi(optarg);
+	      if (n < 1)
+		{
+		  fprintf(stderr, _("%s: invalid number of jobs `%s'\n"),
+			  argv[0], optarg);
+		  return false;
+		}
+
+	      opt_max_jobs = n;
+	    }
+	    break;
+
+	  case 'w':
+	    {
+	      watch_option w;
+	      if (!parse_watch(optarg, w))
+		{
+		  fprintf(stderr, _("%s: invalid watchpoint `%s'\n"),
+			  argv[0], optarg);
+		  return false;
+		}
+
+	      opt_watches.push_back(w);
+	    }
+	    break;
+
+	  case 'T':
+	    opt_watch_trace = optarg;
+	    break;
+
+	  case 0:		// long option
+	    break;
+
+	  case '?':		// unknown option
+	    return false;
+
+	  default:
+	    // logic error
+	    abort();
+	  }
+      }
+
+    return true;
+  }
+
+  void
+  display_help(const char *arg0)
+  {
+    // XXX `--debug' is undocumented
+    printf(_("Usage: %s [OPTION]... [--] COMMAND [ARGUMENT]...\n"), arg0);
+    printf(_("  or:  %s [OPTION]... --jobs=FILE\n"), arg0);
+    printf(_("Run X68000 COMMAND without a display.\n"));
+    printf("\n");
+    printf(_("  -m, --memory-size=N   allocate N megabytes for main memory\n"));
+    printf(_("  -s, --sram-file=FILE  keep SRAM contents in FILE\n"));
+    printf(_("      --memory-file=FILE\n"
+	     "                        keep main memory contents in FILE\n"));
+    printf(_("      --speed=N|max     run the guest clock N times as fast,\n"
+	     "                        or as fast as possible\n"));
+    printf(_("      --load-state=FILE restore the machine from FILE first\n"));
+    printf(_("      --save-state=FILE save the machine to FILE at exit\n"));
+    printf(_("      --checkpoint=FILE update a snapshot in FILE from time to\n"
+	     "                        time\n"));
+    printf(_("      --checkpoint-interval=N\n"
+	     "                        take a checkpoint every N seconds\n"));
+    printf(_("      --record-events=FILE\n"
+	     "                        record input and timer events to FILE\n"));
+    printf(_("      --replay-events=FILE\n"
+	     "                        replay events recorded in FILE\n"));
+    printf(_("      --jobs=FILE       run each line of FILE as a command in a\n"
+	     "                        forked copy of the machine\n"));
+    printf(_("      --max-jobs=N      run up to N jobs at a time\n"));
+    printf(_("      --watch=FIRST-LAST[:rwx]\n"
+	     "                        watch reads, writes or execution in the\n"
+	     "                        range (writes by default)\n"));
+    printf(_("      --watch-trace=FILE\n"
+	     "                        write watchpoint hits to FILE\n"));
+    printf(_("      --help            display this help and exit\n"));
+    printf(_("      --version         output version information and exit\n"));
+    printf("\n");
+    printf(_("Report bugs to <vx68k@lists.hypercore.co.jp>.\n"));
+  }
+
+  /* Runs command NAME with arguments ARGS in a new context of ENV,
+     and returns its exit code.  Watchpoint hits on VM are traced to
+     WATCH_TRACE if it is not null.  */
+  int
+  run_command(machine &vm, human::dos &env, const char *name,
+	      const char *const *args, FILE *watch_trace = NULL)
+  {
+    human::dos_exec_context *c = env.create_context();
+    if (watch_trace != NULL)
+      vm.set_watch_trace(watch_trace, c);
+    int status;
+    {
+      human::shell p(c);
+      status = p.exec(name, args, environ);
+    }
+    if (watch_trace != NULL)
+      vm.set_watch_trace(NULL, NULL);
+    delete c;
+
+    return status;
+  }
+
+  /* Connects the standard input of a job to /dev/null and its
+     standard output and error to LOG_NAME.  Returns false on
+     failure.  */
+  bool
+  redirect_job(const char *log_name)
+  {
+    int in = open("/dev/null", O_RDONLY);
+    if (in == -1)
+      return false;
+    int out = open(log_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out == -1)
+      return false;
+
+    if (dup2(in, STDIN_FILENO) == -1
+	|| dup2(out, STDOUT_FILENO) == -1
+	|| dup2(out, STDERR_FILENO) == -1)
+      return false;
+
+    if (in > STDERR_FILENO)
+      close(in);
+    if (out > STDERR_FILENO)
+      close(out);
+    return true;
+  }
+
+  /* Reads a line of any length from STREAM into LINE, without the
+     newline.  Returns false at the end of STREAM.  */
+  bool
+  read_line(FILE *stream, string &line)
+  {
+    line.clear();
+    char buf[256];
+    while (fgets(buf, sizeof buf, stream) != NULL)
+      {
+	size_t n = strlen(buf);
+	if (n != 0 && buf[n - 1] == '\n')
+	  {
+	    line.append(buf, n - 1);
+	    return true;
+	  }
+	line.append(buf, n);
+      }
+
+    return !line.empty();
+  }
+
+  /* Runs each line of opt_jobs as a command in a child process.  The
+     children are forked from this process after the machine and ENV
+     are set up, so they share its memory pages copy-on-write.  Each
+     child reads /dev/null and writes to its own log, FILE.N.log for
+     line N of FILE.  No other thread may exist at this point, as a
+     forked child would inherit any mutex held by one.  Returns the
+     exit status for this program.  */
+  int
+  run_jobs(const char *arg0, machine &vm, const console &con,
+	   human::dos &env)
+  {
+    FILE *jobs = fopen(opt_jobs, "r");
+    if (jobs == NULL)
+      {
+	perror(opt_jobs);
+	return EXIT_FAILURE;
+      }
+
+    map<pid_t, string> running;
+    unsigned int failures = 0;
+
+    string line;
+    unsigned long line_number = 0;
+    bool more = true;
+    for (;;)
+      {
+	// A line is read only when a job can be started for it.
+	if (running.size() == opt_max_jobs || (!more && !running.empty()))
+	  {
+	    int status;
+	    pid_t pid = wait(&status);
+	    if (pid == -1)
+	      {
+		if (errno == EINTR)
+		  continue;
+		perror(arg0);
+		failures += running.size();
+		break;
+	      }
+
+	    map<pid_t, string>::iterator found = running.find(pid);
+	    if (found == running.end())
+	      continue;
+	    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	      {
+		fprintf(stderr, _("%s: `%s' failed with status %d\n"),
+			arg0, found->second.c_str(),
+			WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+		++failures;
+	      }
+	    running.erase(found);
+	    continue;
+	  }
+	if (!more)
+	  break;
+
+	if (!read_line(jobs, line))
+	  {
+	    more = false;
+	    continue;
+	  }
+	++line_number;
+
+	// Arguments are split at blanks, with no quoting.
+	vector<char> text(line.begin(), line.end());
+	text.push_back('\0');
+	vector<char *> args;
+	for (char *i = strtok(&text[0], " \t"); i != NULL;
+	     i = strtok(NULL, " \t"))
+	  args.push_back(i);
+	if (args.empty())
+	  continue;
+	args.push_back(NULL);
+
+	char suffix[32];
+	sprintf(suffix, ".%lu.log", line_number);
+	string log_name = string(opt_jobs) + suffix;
+
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid == -1)
+	  {
+	    perror(arg0);
+	    ++failures;
+	    continue;
+	  }
+
+	if (pid == 0)
+	  {
+	    if (!redirect_job(log_name.c_str()))
+	      {
+		perror(log_name.c_str());
+		_exit(EXIT_FAILURE);
+	      }
+
+	    int status = EXIT_FAILURE;
+	    try
+	      {
+		timer_thread timers(&vm, &con);
+		status = run_command(vm, env, args[0], &args[1]);
+	      }
+	    catch (exception &x)
+	      {
+		fprintf(stderr, _("%s: unhandled exception: %s\n"), arg0,
+			x.what());
+	      }
+	    // The parent owns everything else, including stdio buffers.
+	    _exit(status);
+	  }
+
+	running.insert(make_pair(pid, line));
+      }
+
+    fclose(jobs);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+} // (unnamed)
+
+/* vx68k-run main.  */
+int
+main(int argc, char **argv)
+{
+#ifdef LOCALEDIR
+  bindtextdomain(PACKAGE, LOCALEDIR);
+#endif
+  textdomain(PACKAGE);
+
+  if (!parse_options(argc, argv))
+    {
+      fprintf(stderr, _("Try `%s --help' for more information.\n"), argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  if (opt_version)
+    {
+      printf("%s %s\n", PACKAGE, VERSION);
+      printf(_("Copyright (C) %s Hypercore Software Design, Ltd.\n"),
+	     COPYRIGHT_YEAR);
+      return EXIT_SUCCESS;
+    }
+
+  if (opt_help)
+    {
+      display_help(argv[0]);
+      return EXIT_SUCCESS;
+    }
+
+  if (argc <= optind && opt_jobs == NULL)
+    {
+      fprintf(stderr, _("%s: missing command argument\n"), argv[0]);
+      fprintf(stderr, _("Try `%s --help' for more information.\n"), argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  // Forked processes would share a memory file instead of copying it.
+  if (opt_memory_file != NULL
+      && (opt_jobs != NULL || opt_checkpoint != NULL))
+    {
+      fprintf(stderr, _("%s: `--memory-file' cannot be used with `--jobs'"
+			" or `--checkpoint'\n"), argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  if (!opt_watches.empty() && opt_watch_trace == NULL)
+    {
+      fprintf(stderr, _("%s: `--watch' requires `--watch-trace'\n"),
+	      argv[0]);
+      return EXIT_FAILURE;
+    }
+  if (opt_watch_trace != NULL && opt_jobs != NULL)
+    {
+      fprintf(stderr, _("%s: `--watch-trace' cannot be used with"
+			" `--jobs'\n"), argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  // Jobs would all write to the same files.
+  if (opt_jobs != NULL
+      && (opt_checkpoint != NULL || opt_record_events != NULL
+	  || opt_replay_events != NULL || opt_save_state != NULL))
+    {
+      fprintf(stderr, _("%s: `--checkpoint', `--record-events',"
+			" `--replay-events' and `--save-state' cannot be"
+			" used with `--jobs'\n"), argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  try
+    {
+      batch_console con;
+      machine vm(opt_memory_size, opt_sram_file, opt_memory_file);
+      vm.connect(&con);
+      vm.set_speed(opt_speed);
+
+      // The DOS environment configures its own address space, which
+      // must see the watchpoints.
+      for (vector<watch_option>::const_iterator i = opt_watches.begin();
+	   i != opt_watches.end(); ++i)
+	vm.add_watchpoint(i->first, i->last, i->kinds);
+
+      human::dos env(&vm);
+      env.set_host_console(true);
+      if (opt_debug_level > 0)
+	env.set_debug_level(1);
+
+      // The snapshot replaces the memory the DOS environment has just
+      // set up, including its memory chain, which must be taken back.
+      if (opt_load_state != NULL)
+	{
+	  int fildes = open(opt_load_state, O_RDONLY);
+	  if (fildes == -1)
+	    {
+	      perror(opt_load_state);
+	      return EXIT_FAILURE;
+	    }
+	  try
+	    {
+	      vm.restore_snapshot(fildes);
+	    }
+	  catch (...)
+	    {
+	      close(fildes);
+	      throw;
+	    }
+	  close(fildes);
+	  env.memory_restored();
+	}
+
+      if (opt_jobs != NULL)
+	return run_jobs(argv[0], vm, con, env);
+
+      int checkpoint_fildes = -1;
+      if (opt_checkpoint != NULL)
+	{
+	  checkpoint_fildes = open(opt_checkpoint,
+				   O_RDWR | O_CREAT | O_TRUNC, 0666);
+	  if (checkpoint_fildes == -1)
+	    {
+	      perror(opt_checkpoint);
+	      return EXIT_FAILURE;
+	    }
+	  vm.start_checkpoints(checkpoint_fildes,
+			       opt_checkpoint_interval * 1000);
+	}
+
+      FILE *watch_trace = NULL;
+      if (opt_watch_trace != NULL)
+	{
+	  watch_trace = fopen(opt_watch_trace, "wb");
+	  if (watch_trace == NULL)
+	    {
+	      perror(opt_watch_trace);
+	      return EXIT_FAILURE;
+	    }
+	}
+
+      FILE *event_file = NULL;
+      if (opt_record_events != NULL || opt_replay_events != NULL)
+	{
+	  bool recording = opt_record_events != NULL;
+	  const char *name = recording ? opt_record_events : opt_replay_events;
+	  event_file = fopen(name, recording ? "w" : "r");
+	  if (event_file == NULL)
+	    {
+	      perror(name);
+	      return EXIT_FAILURE;
+	    }
+	  if (recording)
+	    vm.record_events(event_file);
+	  else
+	    vm.replay_events(event_file);
+	}
+
+      int status;
+      {
+	timer_thread timers(&vm, &con);
+	status = run_command(vm, env, argv[optind], argv + optind + 1,
+			     watch_trace);
+      }
+
+      if (watch_trace != NULL)
+	fclose(watch_trace);
+
+      if (event_file != NULL)
+	{
+	  vm.stop_events();
+	  fclose(event_file);
+
+	  fprintf(stderr, _("%s: %lu steps, memory checksum %08lx\n"),
+		  argv[0], vm.step_count(),
+		  (unsigned long) vm.memory_checksum());
+	}
+
+      if (checkpoint_fildes != -1)
+	{
+	  vm.stop_checkpoints();
+	  close(checkpoint_fildes);
+
+	  if (opt_debug_level > 0)
+	    {
+	      const checkpoint_stats &st = vm.checkpoint_statistics();
+	      fprintf(stderr,
+		      "%s: %lu checkpoints (%lu skipped, %lu failed), "
+		      "pause %lu us max, interval %lu ms\n",
+		      argv[0], st.started, st.skipped, st.failed,
+		      st.max_pause, (unsigned long) st.interval);
+	    }
+	}
+
+      if (opt_save_state != NULL)
+	{
+	  int fildes = open(opt_save_state, O_WRONLY | O_CREAT | O_TRUNC,
+			    0666);
+	  if (fildes == -1)
+	    {
+	      perror(opt_save_state);
+	      return EXIT_FAILURE;
+	    }
+	  try
+	    {
+	      vm.save_snapshot(fildes);
+	    }
+	  catch (...)
+	    {
+	      close(fildes);
+	      throw;
+	    }
+	  close(fildes);
+	}
+
+      return status;
+    }
+  catch (exception &x)
+    {
+      fprintf(stderr, _("%s: unhandled exception: %s\n"), argv[0], x.what());
+      return EXIT_FAILURE;
+    }
+}
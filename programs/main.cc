@@ -45,6 +45,7 @@
 #include <stdexcept>
 #include <csignal>
 #include <cstdlib>
+#include <cstring>
 #include <cstdio>
 
 #ifdef HAVE_NANA_H
@@ -73,8 +74,11 @@ class gtk_app: public virtual console_callback
 public:
   /* Program options.  */
   static size_t opt_memory_size;
+  static const char *opt_sram_file;
+  static unsigned int opt_speed;
   static int opt_single_threaded;
   static int opt_debug_level;
+  static int opt_profile;
 
 protected:
   static void *run_machine_thread(void *) throw ();
@@ -83,6 +87,9 @@ private:
   machine vm;
   gtk_console con;
 
+  /* Profile of the VM if opt_profile is set.  */
+  execution_profile profile;
+
   /* Exit status of the VM.  */
   int vm_status;
 
@@ -118,6 +125,24 @@ public:
   /* Waits for the program to exit.  */
   void join(int *st);
 
+  /* Writes the profile of the VM.  */
+  void report_profile(FILE *out) const
+  {profile.report(out);}
+
+  /* Records external events of the VM to OUT, or replays them from
+     IN.  */
+  void record_events(FILE *out) {vm.record_events(out);}
+  void replay_events(FILE *in) {vm.replay_events(in);}
+
+  /* Stops recording or replaying events and writes the number of
+     steps and the memory checksum of the VM to OUT.  */
+  void finish_events(const char *arg0, FILE *out)
+  {
+    vm.stop_events();
+    fprintf(out, _("%s: %lu steps, memory checksum %08lx\n"),
+	    arg0, vm.step_count(), (unsigned long) vm.memory_checksum());
+  }
+
 public:
   /* Loads an image file on a FD unit.  */
   void load_fd_image(unsigned int u, int fildes)
@@ -128,8 +153,11 @@ public:
 };
 
 size_t gtk_app::opt_memory_size = 0;
+const char *gtk_app::opt_sram_file = "sram";
+unsigned int gtk_app::opt_speed = 1;
 int gtk_app::opt_single_threaded = false;
 int gtk_app::opt_debug_level = 0;
+int gtk_app::opt_profile = false;
 
 void
 gtk_app::run_boot() throw ()
@@ -173,10 +201,20 @@ gtk_app::run_machine()
     env.set_debug_level(1);
 
   human::dos_exec_context *c = env.create_context();
+  if (opt_profile)
+    {
+      profile.set_sampled_context(c);
+      env.set_profile(&profile);
+    }
   {
     human::shell p(c);
     vm_status = p.exec(vm_args[0], vm_args + 1, environ);
   }
+  if (opt_profile)
+    {
+      env.set_profile(NULL);
+      profile.set_sampled_context(NULL);
+    }
   delete c;
 }
 
@@ -239,6 +277,12 @@ gtk_app::boot()
 {
   vm_status = 0;
 
+  if (opt_profile)
+    {
+      profile.set_sampled_context(vm.master_context());
+      vm.set_profile(&profile);
+    }
+
   if (opt_single_threaded)
     run_boot();
   else
@@ -294,13 +338,14 @@ gtk_app::window_closed()
 const size_t MEMSIZE = 4 * 1024 * 1024; // FIXME
 
 gtk_app::gtk_app()
-  : vm(opt_memory_size > 0 ? opt_memory_size : MEMSIZE),
+  : vm(opt_memory_size > 0 ? opt_memory_size : MEMSIZE, opt_sram_file),
     con(&vm),
     main_window(NULL)
 {
   vm_thread = pthread_self();
   gtk_widget_set_default_visual(gtk_console::best_visual());
   vm.connect(&con);
+  vm.set_speed(opt_speed);
 }
 
 namespace
@@ -311,6 +356,11 @@ namespace
   /* File names of FD images.  */
   const char *opt_fd_images[2] = {"", ""};
 
+  /* Files to record external events to or replay them from, or
+     null.  */
+  const char *opt_record_events = NULL;
+  const char *opt_replay_events = NULL;
+
   int opt_help = false;
   int opt_version = false;
 
@@ -322,8 +372,13 @@ namespace
 	 {"fd0-image", required_argument, NULL, '0'},
 	 {"fd1-image", required_argument, NULL, '1'},
 	 {"memory-size", required_argument, NULL, 'm'},
+	 {"sram-file", required_argument, NULL, 's'},
+	 {"speed", required_argument, NULL, 'S'},
 	 {"one-thread", no_argument, &gtk_app::opt_single_threaded, true},
 	 {"debug", no_argument, &gtk_app::opt_debug_level, 1},
+	 {"profile", no_argument, &gtk_app::opt_profile, true},
+	 {"record-events", required_argument, NULL, 'R'},
+	 {"replay-events", required_argument, NULL, 'Y'},
 	 {"help", no_argument, &opt_help, true},
 	 {"version", no_argument, &opt_version, true},
 	 {NULL, 0, NULL, 0}};
@@ -331,7 +386,7 @@ namespace
     for (;;)
       {
 	int index;
-	int opt = getopt_long(argc, argv, "0:1:bm:", longopts, &index);
+	int opt = getopt_long(argc, argv, "0:1:bm:s:", longopts, &index);
 	if (opt == -1)		// no more options
 	  break;
 
@@ -363,6 +418,35 @@ namespace
 	    }
 	  break;
 
+	  case 's':
+	    gtk_app::opt_sram_file = optarg;
+	    break;
+
+	  case 'S':
+	    if (strcmp(optarg, "max") == 0)
+	      gtk_app::opt_speed = 0;
+	    else
+	      {
+		int n = atoi(optarg);
+		if (n < 1)
+		  {
+		    fprintf(stderr, _("%s: invalid speed `%s'\n"),
+			    argv[0], optarg);
+		    return false;
+		  }
+
+		gtk_app::opt_speed = n;
+	      }
+	    break;
+
+	  case 'R':
+	    opt_record_events = optarg;
+	    break;
+
+	  case 'Y':
+	    opt_replay_events = optarg;
+	    break;
+
 	  case 0:		// long option
 	    break;
 
@@ -389,7 +473,15 @@ namespace
     printf(_("  -0, --fd0-image=FILE  load FILE on FD unit 0 as an image\n"));
     printf(_("  -1, --fd1-image=FILE  load FILE on FD unit 1 as an image\n"));
     printf(_("  -m, --memory-size=N   allocate N megabytes for main memory\n"));
+    printf(_("  -s, --sram-file=FILE  keep SRAM contents in FILE\n"));
     printf(_("      --one-thread      run in one thread\n"));
+    printf(_("      --speed=N|max     run the guest clock N times as fast,\n"
+	     "                        or as fast as possible\n"));
+    printf(_("      --profile         report IOCS and DOS calls on exit\n"));
+    printf(_("      --record-events=FILE\n"
+	     "                        record input and timer events to FILE\n"));
+    printf(_("      --replay-events=FILE\n"
+	     "                        replay events recorded in FILE\n"));
     printf(_("      --help            display this help and exit\n"));
     printf(_("      --version         output version information and exit\n"));
     printf("\n");
@@ -467,6 +559,23 @@ main(int argc, char **argv)
 	      }
 	  }
 
+      FILE *event_file = NULL;
+      if (opt_record_events != NULL || opt_replay_events != NULL)
+	{
+	  bool recording = opt_record_events != NULL;
+	  const char *name = recording ? opt_record_events : opt_replay_events;
+	  event_file = fopen(name, recording ? "w" : "r");
+	  if (event_file == NULL)
+	    {
+	      perror(name);
+	      return EXIT_FAILURE;
+	    }
+	  if (recording)
+	    app.record_events(event_file);
+	  else
+	    app.replay_events(event_file);
+	}
+
       if (opt_boot)
 	{
 	  app.boot();
@@ -483,6 +592,13 @@ main(int argc, char **argv)
 
       int status;
       app.join(&status);
+      if (event_file != NULL)
+	{
+	  app.finish_events(argv[0], stderr);
+	  fclose(event_file);
+	}
+      if (gtk_app::opt_profile)
+	app.report_profile(stderr);
       return status;
     }
   catch (exception &x)